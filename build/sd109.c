@@ -36,13 +36,86 @@
 #include <linux/hwmon.h>
 #include <linux/jiffies.h>
 #include <linux/reboot.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/freezer.h>
+#include <linux/delay.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/timer.h>
+#include <linux/slab.h>
 
 #include "sd109.h"
 
-static struct sd109_private *notify_data;
+#define CREATE_TRACE_POINTS
+#include "sd109_trace.h"
 
-const struct regmap_config sd109_regmap_config = {
+static struct dentry *sd109_debugfs_root;
+
+/****************************************************************************
+ * REGISTER MAP
+ ****************************************************************************/
+static const struct regmap_range sd109_readable_ranges[] = {
+	regmap_reg_range(SD109_CHIP_ID_REG, SD109_STATUS),
+	regmap_reg_range(SD109_WDOG_TIMEOUT, SD109_VOLTAGE_LAST),
+	regmap_reg_range(SD109_RTC0, SD109_WAKEUP2),
+};
+
+static const struct regmap_access_table sd109_readable_table = {
+	.yes_ranges = sd109_readable_ranges,
+	.n_yes_ranges = ARRAY_SIZE(sd109_readable_ranges),
+};
+
+static const struct regmap_range sd109_writeable_ranges[] = {
+	regmap_reg_range(SD109_COMMAND, SD109_COMMAND),
+	regmap_reg_range(SD109_WDOG_REFRESH, SD109_WDOG_TIMEOUT),
+	regmap_reg_range(SD109_RTC0, SD109_WAKEUP2),
+};
+
+static const struct regmap_access_table sd109_writeable_table = {
+	.yes_ranges = sd109_writeable_ranges,
+	.n_yes_ranges = ARRAY_SIZE(sd109_writeable_ranges),
+};
+
+/*
+ * Registers changed by the MCU, plus the write-only command registers: these
+ * must never be cached, otherwise regcache_sync would replay a command.
+ */
+static const struct regmap_range sd109_volatile_ranges[] = {
+	regmap_reg_range(SD109_STATUS, SD109_STATUS),
+	regmap_reg_range(SD109_COMMAND, SD109_COMMAND),
+	regmap_reg_range(SD109_WDOG_REFRESH, SD109_WDOG_REFRESH),
+	regmap_reg_range(SD109_VOLTAGE_5V_BOARD, SD109_VOLTAGE_LAST),
+	regmap_reg_range(SD109_RTC0, SD109_RTC2),
+};
+
+static const struct regmap_access_table sd109_volatile_table = {
+	.yes_ranges = sd109_volatile_ranges,
+	.n_yes_ranges = ARRAY_SIZE(sd109_volatile_ranges),
+};
+
+/* Registers with side effects, never to be touched outside the driver */
+static const struct regmap_range sd109_precious_ranges[] = {
+	regmap_reg_range(SD109_COMMAND, SD109_COMMAND),
+	regmap_reg_range(SD109_WDOG_REFRESH, SD109_WDOG_REFRESH),
+};
+
+static const struct regmap_access_table sd109_precious_table = {
+	.yes_ranges = sd109_precious_ranges,
+	.n_yes_ranges = ARRAY_SIZE(sd109_precious_ranges),
+};
+
+static const struct regmap_config sd109_regmap_config = {
 	.max_register = SD109_NUM_REGS - 1,
+	.rd_table = &sd109_readable_table,
+	.wr_table = &sd109_writeable_table,
+	.volatile_table = &sd109_volatile_table,
+	.precious_table = &sd109_precious_table,
 };
 
 static const struct i2c_device_id sd109_id[] = {
@@ -51,364 +124,1210 @@ static const struct i2c_device_id sd109_id[] = {
 };
 MODULE_DEVICE_TABLE(i2c, sd109_id);
 
+/****************************************************************************
+ * INSTRUMENTATION
+ ****************************************************************************/
+static const char * const sd109_op_names[SD109_OP_NUM] = {
+	[SD109_OP_PROBE]          = "probe",
+	[SD109_OP_VIN_INPUT]      = "vin_input",
+	[SD109_OP_VIN_MIN]        = "vin_min",
+	[SD109_OP_VIN_MAX]        = "vin_max",
+	[SD109_OP_VIN_ALARM]      = "vin_alarm",
+	[SD109_OP_VIN_LIMIT]      = "vin_limit",
+	[SD109_OP_VIN_SAMPLE]     = "vin_sample",
+	[SD109_OP_CAPTURE]        = "capture",
+	[SD109_OP_RTC_READ]       = "rtc_read",
+	[SD109_OP_RTC_SET]        = "rtc_set",
+	[SD109_OP_ALARM_READ]     = "alarm_read",
+	[SD109_OP_ALARM_SET]      = "alarm_set",
+	[SD109_OP_WDT_PING]       = "wdt_ping",
+	[SD109_OP_WDT_START]      = "wdt_start",
+	[SD109_OP_WDT_STOP]       = "wdt_stop",
+	[SD109_OP_WDT_SETTIMEOUT] = "wdt_settimeout",
+	[SD109_OP_REBOOT]         = "reboot",
+};
+
 /**
- * @brief HWMON function sd109 get voltage
- * @param [in] dev struct device pointer
- * @param [in] ch channel
- * @return voltage in millivolt
- * @details Returns the voltage of specific channel, from the given register,
- * in millivolts.
+ * @brief STATS function add sample to latency histogram
+ * @param [in] hist log2 histogram
+ * @param [in] delta latency
+ * @details Bucket 0 counts latencies below 1us, bucket n latencies in
+ * [2^(n-1), 2^n) us, the last bucket everything above.
  */
-static int sd109_get_voltage(struct device *dev, u8 ch)
+static void sd109_hist_add(atomic64_t *hist, ktime_t delta)
 {
-	struct sd109_private *data = dev_get_drvdata(dev);
-	int voltage=0;
-	int ret;
-	int reg;
-
-	mutex_lock(&data->update_lock);
-
-	if (ch<NUM_CH_VIN) {
-		if (time_after(jiffies, data->volt_updated[ch] + HZ)
-																						|| !data->volt_valid[ch]) {
-			reg = SD109_VOLTAGE_5V_BOARD + ch*3;
-			/* Get value */
-			ret = regmap_read(data->regmap, reg, &voltage);
-			if (ret < 0) {
-				dev_err(dev, "failed to read I2C when get voltage\n");
-				goto close;
-			}
-			data->volt[ch]=voltage;
-			data->volt_updated[ch] = jiffies;
-			data->volt_valid[ch] = true;
-		} else {
-			voltage = data->volt[ch];
-		}
+	s64 us = ktime_to_us(delta);
+	int bucket = 0;
 
-		mutex_unlock(&data->update_lock);
-	}
+	if (us > 0)
+		bucket = min(ilog2(us) + 1, SD109_HIST_BUCKETS - 1);
 
-close:
-	mutex_unlock(&data->update_lock);
-	return voltage;
+	atomic64_inc(&hist[bucket]);
 }
 
 /**
- * @brief HWMON function sd109 get voltage MAX
- * @param [in] dev struct device pointer
- * @param [in] ch channel
- * @return voltage in millivolt
- * @details Returns the maximum voltage of specific channel, from the given
- * register, in millivolts.
+ * @brief STATS function operation entry
+ * @param [in] data driver private data
+ * @param [in] op operation
+ * @return start time, for tracepoints
  */
-static int sd109_get_voltage_max(struct device *dev, u8 ch)
+static ktime_t sd109_op_begin(struct sd109_private *data, enum sd109_op op)
 {
-	struct sd109_private *data = dev_get_drvdata(dev);
-	int voltage=0;
-	int ret;
-	int reg;
-
-	mutex_lock(&data->update_lock);
-
-	if (ch<NUM_CH_VIN) {
-		if (time_after(jiffies, data->volt_max_updated[ch] + HZ)
-																		|| !data->volt_max_valid[ch]) {
-			reg = SD109_VOLTAGE_5V_BOARD_MAX + ch*3;
-			/* Get value */
-			ret = regmap_read(data->regmap, reg, &voltage);
-			if (ret < 0) {
-				dev_err(dev, "failed to read I2C when get MAX voltage\n");
-				goto close;
-			}
-
-			data->volt_max[ch]=voltage;
-			data->volt_max_updated[ch] = jiffies;
-			data->volt_max_valid[ch] = true;
-		} else {
-			voltage = data->volt_max[ch];
-		}
-
-	}
-
-close:
-	mutex_unlock(&data->update_lock);
-	return voltage;
+	atomic64_inc(&data->op_stats[op].calls);
+	return ktime_get();
 }
 
 /**
- * @brief HWMON function sd109 get voltage MIN
- * @param [in] dev struct device pointer
- * @param [in] ch channel
- * @return voltage in millivolt
- * @details Returns the minimum voltage of specific channel, from the given
- * register, in millivolts.
+ * @brief STATS function operation served from cache
+ * @param [in] data driver private data
+ * @param [in] op operation
  */
-static int sd109_get_voltage_min(struct device *dev, u8 ch)
+static void sd109_op_hit(struct sd109_private *data, enum sd109_op op)
 {
-	struct sd109_private *data = dev_get_drvdata(dev);
-	int voltage=0;
-	int ret;
-	int reg;
-
-	mutex_lock(&data->update_lock);
-
-	if (ch<NUM_CH_VIN) {
-		if (time_after(jiffies, data->volt_min_updated[ch] + HZ)
-																			|| !data->volt_min_valid[ch]) {
-			reg = SD109_VOLTAGE_5V_BOARD_MIN + ch*3;
-			/* Get value */
-			ret = regmap_read(data->regmap, reg, &voltage);
-			if (ret < 0) {
-				dev_err(dev, "failed to read I2C when get MIN voltage\n");
-				goto close;
-			}
-
-			data->volt_min[ch]=voltage;
-			data->volt_min_updated[ch] = jiffies;
-			data->volt_min_valid[ch] = true;
-		} else {
-			voltage = data->volt_min[ch];
-		}
-
-	}
-
-close:
-	mutex_unlock(&data->update_lock);
-	return voltage;
+	atomic64_inc(&data->op_stats[op].cache_hits);
 }
 
 /**
- * @brief HWMON function input read method
- * @param [in] dev struct device pointer
- * @param [in] attr attribute
- * @param [in] channel
- * @param [out] val pointer
- * @return 9 if success.
- * @details Calls the right handler
+ * @brief STATS function take update_lock
+ * @param [in] data driver private data
+ * @param [in] op operation waiting for the lock
+ * @details Records the time spent waiting for update_lock.
  */
-static int sd109_read_in(struct device *dev, u32 attr, int channel, long *val)
+static void sd109_lock(struct sd109_private *data, enum sd109_op op)
 {
-	switch (attr) {
-		case hwmon_in_input:
-			if (channel < NUM_CH_VIN)
-				*val = sd109_get_voltage(dev,channel);
-			else
-				return -EOPNOTSUPP;
-			return 0;
-		case hwmon_in_max:
-				if (channel < NUM_CH_VIN)
-					*val = sd109_get_voltage_max(dev,channel);
-				else
-					return -EOPNOTSUPP;
-				return 0;
-		case hwmon_in_min:
-				if (channel < NUM_CH_VIN)
-					*val = sd109_get_voltage_min(dev,channel);
-				else
-					return -EOPNOTSUPP;
-				return 0;
-		default:
-			return -EOPNOTSUPP;
-	}
+	ktime_t start = ktime_get();
+
+	mutex_lock(&data->update_lock);
+	sd109_hist_add(data->op_stats[op].lock_hist,
+				ktime_sub(ktime_get(), start));
 }
 
 /**
- * @brief HWMON function read method
- * @param [in] dev struct device pointer
- * @param [in] type enum hwmon_sensor_types
- * @param [in] attr attribute
- * @param [in] channel
- * @param [out] val pointer
- * @return 0 if success.
- * @details Calls the right handler
+ * @brief STATS function account a bus transfer
+ * @param [in] data driver private data
+ * @param [in] reg first register
+ * @param [in] count number of registers transferred
+ * @param [in] write true for writes
+ * @param [in] ret transfer result
+ * @param [in] delta transfer latency
+ * @details Called for every I2C transfer issued by regmap, whoever started
+ * the access: each register covered by the transfer is charged. Transfers of
+ * the driver's own accesses are also collected for the operation counters.
  */
-static int sd109_read(struct device *dev, enum hwmon_sensor_types type,
-			u32 attr, int channel, long *val)
+static void sd109_bus_account(struct sd109_private *data, unsigned int reg,
+			unsigned int count, bool write, int ret, ktime_t delta)
 {
-	switch (type) {
-		case hwmon_in:
-			return sd109_read_in(dev, attr, channel, val);
-		default:
-			return -EOPNOTSUPP;
+	struct sd109_reg_stats *regs;
+	unsigned int i;
+
+	count = min_t(unsigned int, count, SD109_NUM_REGS - reg);
+	for (i=0; i<count; i++) {
+		regs = &data->reg_stats[reg + i];
+		atomic64_inc(write ? &regs->writes : &regs->reads);
+		if (ret)
+			atomic64_inc(&regs->errors);
+		sd109_hist_add(regs->bus_hist, delta);
 	}
+
+	if (READ_ONCE(data->bus_owner) != current)
+		return;
+
+	data->bus_xfers++;
+	if (!write)
+		bitmap_set(data->bus_fetched, reg, count);
 }
 
 /**
- * @brief HWMON function return channel name
- * @param [in] dev struct device pointer
- * @param [in] type enum hwmon_sensor_types
- * @param [in] attr attribute
- * @param [in] channel
- * @param [out] str string pointer
- * @return 0 if success.
- * @details Returns the label of channel.
+ * @brief STATS function start a register access
+ * @param [in] data driver private data
+ * @details Takes the regmap lock for the whole access, so the transfers seen
+ * by sd109_bus_account until sd109_access_end belong to this access only.
  */
-static int sd109_read_string(struct device *dev, enum hwmon_sensor_types type,
-		       u32 attr, int channel, const char **str)
+static void sd109_access_begin(struct sd109_private *data)
 {
-	switch (type) {
-		case hwmon_in:
-			switch (attr) {
-				case hwmon_in_label:
-					switch (channel) {
-						case 0:
-							*str = "BOARD 5V";
-							return 0;
-						case 1:
-							*str = "SoC 5V";
-							return 0;
-						case 2:
-							*str = "SoC 3V3";
-							return 0;
-						case 3:
-							*str = "SoC 1V8";
-							return 0;
-						case 4:
-							*str = "Vin 24V";
-							return 0;
-						default:
-							*str = NULL;
-							break;
-					}
-					return -EOPNOTSUPP;
-				default:
-					return -EOPNOTSUPP;
-			}
-		default:
-			return -EOPNOTSUPP;
-	}
-	return -EOPNOTSUPP;
+	mutex_lock(&data->bus_lock);
+	WRITE_ONCE(data->bus_owner, current);
+	data->bus_xfers = 0;
+	bitmap_zero(data->bus_fetched, SD109_NUM_REGS);
 }
 
 /**
- * @brief HWMON function return access attribute
- * @param [in] data unused
- * @param [in] type enum hwmon_sensor_types
- * @param [in] attr attribute
- * @param [in] channel
- * @return permission.
- * @details Returns file access permission
+ * @brief STATS function end a register access
+ * @param [in] data driver private data
+ * @param [in] op operation
+ * @param [in] reg first register
+ * @param [in] count number of registers accessed
+ * @param [in] write true for writes
+ * @param [in] ret access result
+ * @param [in] delta access latency
+ * @details Registers read without a bus transfer were served by regcache.
  */
-static umode_t sd109_is_visible(const void *data, enum hwmon_sensor_types type,
-			       u32 attr, int channel)
+static void sd109_access_end(struct sd109_private *data, enum sd109_op op,
+			unsigned int reg, size_t count, bool write, int ret, ktime_t delta)
 {
-	switch (type) {
-		case hwmon_in:
-			switch (attr) {
-				case hwmon_in_input:
-					return S_IRUGO;
-				case hwmon_in_label:
-					return S_IRUGO;
- 				case hwmon_in_max:
-					return S_IRUGO;
-				case hwmon_in_min:
-					return S_IRUGO;
-				default:
-					break;
-			}
-			break;
-		default:
-			break;
+	struct sd109_op_stats *ops = &data->op_stats[op];
+	unsigned int xfers = data->bus_xfers;
+	unsigned int hits = 0;
+	size_t i;
+
+	if (!write && !ret) {
+		for (i=0; i<count; i++) {
+			if (test_bit(reg + i, data->bus_fetched))
+				continue;
+			atomic64_inc(&data->reg_stats[reg + i].cache_hits);
+			hits++;
+		}
 	}
-	return 0;
+
+	WRITE_ONCE(data->bus_owner, NULL);
+	mutex_unlock(&data->bus_lock);
+
+	if (ret)
+		atomic64_inc(&ops->errors);
+
+	atomic64_add(hits, &ops->cache_hits);
+	if (!xfers)
+		return;
+
+	atomic64_add(xfers, &ops->xfers);
+	atomic64_inc(&ops->cache_misses);
+	sd109_hist_add(ops->bus_hist, delta);
 }
 
-/****************************************************************************
- * HWMON STRUCTURES
- ****************************************************************************/
-static const u32 sd109_in_config[] = {
-	(HWMON_I_INPUT|HWMON_I_LABEL|HWMON_I_MAX|HWMON_I_MIN),
-	(HWMON_I_INPUT|HWMON_I_LABEL|HWMON_I_MAX|HWMON_I_MIN),
-	(HWMON_I_INPUT|HWMON_I_LABEL|HWMON_I_MAX|HWMON_I_MIN),
-	(HWMON_I_INPUT|HWMON_I_LABEL|HWMON_I_MAX|HWMON_I_MIN),
-	(HWMON_I_INPUT|HWMON_I_LABEL|HWMON_I_MAX|HWMON_I_MIN),
-	0
-};
+static int sd109_reg_read(struct sd109_private *data, enum sd109_op op,
+			unsigned int reg, unsigned int *val)
+{
+	ktime_t start = ktime_get();
+	int ret;
 
-static const struct hwmon_channel_info sd109_voltage = {
-	.type = hwmon_in,
-	.config = sd109_in_config,
-};
+	sd109_access_begin(data);
+	ret = regmap_read(data->regmap, reg, val);
+	sd109_access_end(data, op, reg, 1, false, ret,
+				ktime_sub(ktime_get(), start));
 
-static const struct hwmon_channel_info *sd109_info[] = {
-	&sd109_voltage,
-	NULL
-};
+	return ret;
+}
 
-static const struct hwmon_ops sd109_hwmon_ops = {
-	.is_visible = sd109_is_visible,
-	.read = sd109_read,
-	.read_string = sd109_read_string,
-};
+static int sd109_reg_write(struct sd109_private *data, enum sd109_op op,
+			unsigned int reg, unsigned int val)
+{
+	ktime_t start = ktime_get();
+	int ret;
 
-static const struct hwmon_chip_info sd109_chip_info = {
-	.ops = &sd109_hwmon_ops,
-	.info = sd109_info,
-};
+	sd109_access_begin(data);
+	ret = regmap_write(data->regmap, reg, val);
+	sd109_access_end(data, op, reg, 1, true, ret,
+				ktime_sub(ktime_get(), start));
 
-/****************************************************************************
- * WATCHDOG OPS
- ****************************************************************************/
+	return ret;
+}
 
-static int sd109_wdt_ping(struct watchdog_device *wdd)
+static int sd109_bulk_read(struct sd109_private *data, enum sd109_op op,
+			unsigned int reg, void *val, size_t count)
 {
-	struct sd109_private *data = watchdog_get_drvdata(wdd);
-	int ret = regmap_write(data->regmap, SD109_WDOG_REFRESH,
-		SD109_WDOG_REFRESH_MAGIC_VALUE);
+	ktime_t start = ktime_get();
+	int ret;
+
+	sd109_access_begin(data);
+	ret = regmap_bulk_read(data->regmap, reg, val, count);
+	sd109_access_end(data, op, reg, count, false, ret,
+				ktime_sub(ktime_get(), start));
 
 	return ret;
 }
 
-static int sd109_wdt_start(struct watchdog_device *wdd)
+static int sd109_bulk_write(struct sd109_private *data, enum sd109_op op,
+			unsigned int reg, const void *val, size_t count)
 {
-	struct sd109_private *data = watchdog_get_drvdata(wdd);
-	int ret = regmap_write(data->regmap, SD109_COMMAND,	SD109_WDOG_ENABLE);
+	ktime_t start = ktime_get();
+	int ret;
+
+	sd109_access_begin(data);
+	ret = regmap_bulk_write(data->regmap, reg, val, count);
+	sd109_access_end(data, op, reg, count, true, ret,
+				ktime_sub(ktime_get(), start));
 
 	return ret;
 }
 
-static int sd109_wdt_stop(struct watchdog_device *wdd)
+/****************************************************************************
+ * REGMAP BUS
+ ****************************************************************************/
+
+/*
+ * Plain I2C transfers, as regmap-i2c does, wrapped to account every transfer
+ * at the bus: register cache hits are measured rather than guessed.
+ */
+static int sd109_bus_write(void *context, const void *buf, size_t count)
 {
-	struct sd109_private *data = watchdog_get_drvdata(wdd);
-	int	ret = regmap_write(data->regmap, SD109_COMMAND,	SD109_WDOG_DISABLE);
+	struct sd109_private *data = context;
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = i2c_master_send(data->client, buf, count);
+	if (ret == count)
+		ret = 0;
+	else if (ret >= 0)
+		ret = -EIO;
+
+	sd109_bus_account(data, *(const u8 *)buf,
+				(count - SD109_REG_BYTES)/SD109_VAL_BYTES, true, ret,
+				ktime_sub(ktime_get(), start));
 
 	return ret;
 }
 
-static int sd109_wdt_settimeout(struct watchdog_device *wdd, unsigned int to)
+static int sd109_bus_read(void *context, const void *reg_buf, size_t reg_size,
+			void *val_buf, size_t val_size)
 {
-	struct sd109_private *data = watchdog_get_drvdata(wdd);
+	struct sd109_private *data = context;
+	struct i2c_client *client = data->client;
+	struct i2c_msg xfer[2];
+	ktime_t start = ktime_get();
 	int ret;
-	unsigned int reg;
 
-	if ((watchdog_timeout_invalid(wdd, to))||(to>255)) {
-		return -EINVAL;
-	}
+	xfer[0].addr = client->addr;
+	xfer[0].flags = 0;
+	xfer[0].len = reg_size;
+	xfer[0].buf = (void *)reg_buf;
 
-	/* build up register value */
-	reg = ((data->wdog_wait/5)<<SD109_WDOG_WAIT_POS)&SD109_WDOG_WAIT_MASK;
-	reg |= (to&SD109_WDOG_TIMEOUT_MASK)<<SD109_WDOG_TIMEOUT_POS;
+	xfer[1].addr = client->addr;
+	xfer[1].flags = I2C_M_RD;
+	xfer[1].len = val_size;
+	xfer[1].buf = val_buf;
 
-	ret = regmap_write(data->regmap, SD109_WDOG_TIMEOUT,reg);
+	ret = i2c_transfer(client->adapter, xfer, ARRAY_SIZE(xfer));
+	if (ret == ARRAY_SIZE(xfer))
+		ret = 0;
+	else if (ret >= 0)
+		ret = -EIO;
 
-	wdd->timeout = to;
+	sd109_bus_account(data, *(const u8 *)reg_buf, val_size/SD109_VAL_BYTES,
+				false, ret, ktime_sub(ktime_get(), start));
 
-	return 0;
+	return ret;
 }
 
-/****************************************************************************
- * WATCHDOG STRUCTURES
- ****************************************************************************/
-static const struct watchdog_ops sd109_wdt_ops = {
-	.owner = THIS_MODULE,
-	.start = sd109_wdt_start,
-	.stop = sd109_wdt_stop,
+static const struct regmap_bus sd109_regmap_bus = {
+	.write = sd109_bus_write,
+	.read = sd109_bus_read,
+};
+
+/*
+ * The regmap lock: already held by the driver around its own accesses, see
+ * sd109_access_begin, taken here for everything else (regcache sync, regmap
+ * debugfs).
+ */
+static void sd109_regmap_lock(void *arg)
+{
+	struct sd109_private *data = arg;
+
+	if (READ_ONCE(data->bus_owner) != current)
+		mutex_lock(&data->bus_lock);
+}
+
+static void sd109_regmap_unlock(void *arg)
+{
+	struct sd109_private *data = arg;
+
+	if (READ_ONCE(data->bus_owner) != current)
+		mutex_unlock(&data->bus_lock);
+}
+
+/**
+ * @brief HWMON function sd109 check voltage alarms
+ * @param [in] data driver private data
+ * @param [in,out] snap voltage snapshot, alarms updated in place
+ * @return mask of alarm bits that changed.
+ * @details An alarm is raised when the input crosses its threshold and is
+ * cleared only once the input is back by more than the channel hysteresis.
+ * A zero threshold disables the check. Must be called with update_lock held.
+ */
+static unsigned long sd109_check_alarms(struct sd109_private *data,
+			struct sd109_vin_snapshot *snap)
+{
+	unsigned long alarms = snap->alarms;
+	int volt;
+	int ch;
+
+	for (ch=0; ch<NUM_CH_VIN; ch++) {
+		volt = snap->volt[ch];
+
+		if (!data->vin_lim_min[ch])
+			clear_bit(SD109_ALARM_MIN(ch), &alarms);
+		else if (volt < data->vin_lim_min[ch])
+			set_bit(SD109_ALARM_MIN(ch), &alarms);
+		else if (volt >= data->vin_lim_min[ch] + data->vin_hyst[ch])
+			clear_bit(SD109_ALARM_MIN(ch), &alarms);
+
+		if (!data->vin_lim_max[ch])
+			clear_bit(SD109_ALARM_MAX(ch), &alarms);
+		else if (volt > data->vin_lim_max[ch])
+			set_bit(SD109_ALARM_MAX(ch), &alarms);
+		else if (volt <= data->vin_lim_max[ch] - data->vin_hyst[ch])
+			clear_bit(SD109_ALARM_MAX(ch), &alarms);
+	}
+
+	alarms ^= snap->alarms;
+	snap->alarms ^= alarms;
+
+	return alarms;
+}
+
+/**
+ * @brief HWMON function sd109 publish voltage snapshot
+ * @param [in] data driver private data
+ * @param [in] snap new voltage snapshot
+ * @details Evaluates the alarms, makes the snapshot visible to readers and
+ * wakes up pollers of every alarm attribute that changed. Must be called
+ * with update_lock held.
+ */
+static void sd109_publish_snapshot(struct sd109_private *data,
+			struct sd109_vin_snapshot *snap)
+{
+	unsigned long changed;
+	int ch;
+
+	changed = sd109_check_alarms(data, snap);
+
+	/* Publish: readers retry instead of blocking while this runs */
+	write_seqlock(&data->vin_lock);
+	data->vin = *snap;
+	write_sequnlock(&data->vin_lock);
+
+	if (!changed || !data->hwmon_dev)
+		return;
+
+	for (ch=0; ch<NUM_CH_VIN; ch++) {
+		if (test_bit(SD109_ALARM_MIN(ch), &changed))
+			hwmon_notify_event(data->hwmon_dev, hwmon_in, hwmon_in_min_alarm, ch);
+		if (test_bit(SD109_ALARM_MAX(ch), &changed))
+			hwmon_notify_event(data->hwmon_dev, hwmon_in, hwmon_in_max_alarm, ch);
+	}
+}
+
+/**
+ * @brief HWMON function sd109 update voltage snapshot
+ * @param [in] data driver private data
+ * @param [in] force refresh even if the snapshot is still fresh
+ * @return 0 if success.
+ * @details Refreshes input/min/max of every channel when the snapshot is
+ * older than update_interval. The whole register block is fetched with a
+ * single I2C transfer. A failed block read is served with per-register reads;
+ * after SD109_VIN_BLOCK_ERRORS consecutive failures, or when the overlay sets
+ * vin_no_block_read, single reads are used from then on. Must be called with
+ * update_lock held.
+ */
+static int sd109_update_voltages(struct sd109_private *data, bool force,
+			enum sd109_op op)
+{
+	struct device *dev = &data->client->dev;
+	struct sd109_vin_snapshot snap;
+	u16 regs[SD109_VIN_NUM_REGS];
+	unsigned int val;
+	int ret;
+	int ch;
+	int i;
+
+	if (!force && data->vin.valid && !time_after(jiffies,
+					data->vin.updated + msecs_to_jiffies(data->update_interval))) {
+		sd109_op_hit(data, op);
+		return 0;
+	}
+
+	if (!data->vin_no_block_read) {
+		ret = sd109_bulk_read(data, op, SD109_VOLTAGE_5V_BOARD, regs,
+				SD109_VIN_NUM_REGS);
+		data->vin_xfers++;
+		if (!ret) {
+			data->vin_block_errors = 0;
+			goto update;
+		}
+	}
+
+	for (i=0; i<SD109_VIN_NUM_REGS; i++) {
+		ret = sd109_reg_read(data, op, SD109_VOLTAGE_5V_BOARD + i, &val);
+		data->vin_xfers++;
+		if (ret < 0) {
+			dev_err(dev, "failed to read I2C when get voltage\n");
+			return ret;
+		}
+		regs[i] = val;
+	}
+
+	/*
+	 * Single reads work where the block read failed. A transient bus error
+	 * must not disable block reads, so switch only once they keep failing.
+	 */
+	if (!data->vin_no_block_read &&
+				(++data->vin_block_errors >= SD109_VIN_BLOCK_ERRORS)) {
+		dev_info(dev, "block read not supported, using single reads\n");
+		data->vin_no_block_read = true;
+		data->vin_block_errors = 0;
+	}
+
+update:
+	for (ch=0; ch<NUM_CH_VIN; ch++) {
+		i = ch*SD109_VIN_REGS_PER_CH;
+		snap.volt[ch] = regs[i + SD109_VIN_INPUT_OFS];
+		snap.volt_min[ch] = regs[i + SD109_VIN_MIN_OFS];
+		snap.volt_max[ch] = regs[i + SD109_VIN_MAX_OFS];
+	}
+	snap.updated = jiffies;
+	snap.valid = true;
+	snap.alarms = data->vin.alarms;
+
+	sd109_publish_snapshot(data, &snap);
+
+	return 0;
+}
+
+/**
+ * @brief HWMON function sd109 get voltage snapshot
+ * @param [in] data driver private data
+ * @param [out] snap copy of the voltage snapshot
+ * @param [in] op operation, for statistics
+ * @return 0 if success.
+ * @details In sampler mode the snapshot is kept fresh by sd109_vin_work and
+ * is copied without taking any lock nor touching the bus; a snapshot the
+ * sampler failed to refresh for SD109_VIN_STALE_INTERVALS periods is not
+ * served. Otherwise the snapshot is refreshed on demand first.
+ */
+static int sd109_get_snapshot(struct sd109_private *data,
+			struct sd109_vin_snapshot *snap, enum sd109_op op)
+{
+	unsigned int seq;
+	bool sampler;
+	int ret;
+
+	/* Toggled under update_lock, read without it */
+	sampler = READ_ONCE(data->vin_sampler);
+	if (!sampler) {
+		sd109_lock(data, op);
+		ret = sd109_update_voltages(data, false, op);
+		mutex_unlock(&data->update_lock);
+		if (ret)
+			return ret;
+	} else {
+		sd109_op_hit(data, op);
+	}
+
+	do {
+		seq = read_seqbegin(&data->vin_lock);
+		*snap = data->vin;
+	} while (read_seqretry(&data->vin_lock, seq));
+
+	if (!snap->valid)
+		return -ENODATA;
+
+	/* Every sample failed lately: report it instead of old values */
+	if (sampler && time_after(jiffies, snap->updated + SD109_VIN_STALE_INTERVALS *
+				msecs_to_jiffies(READ_ONCE(data->update_interval))))
+		return -EAGAIN;
+
+	return 0;
+}
+
+/**
+ * @brief HWMON function sd109 voltage sampler
+ * @param [in] work delayed work embedded in driver private data
+ * @details Refreshes the voltage snapshot every update_interval milliseconds
+ * so that readers never wait on the I2C bus.
+ */
+static void sd109_vin_work(struct work_struct *work)
+{
+	struct sd109_private *data = container_of(to_delayed_work(work),
+				struct sd109_private, vin_work);
+
+	sd109_op_begin(data, SD109_OP_VIN_SAMPLE);
+	sd109_lock(data, SD109_OP_VIN_SAMPLE);
+	sd109_update_voltages(data, true, SD109_OP_VIN_SAMPLE);
+	if (data->vin_sampler)
+		schedule_delayed_work(&data->vin_work,
+					msecs_to_jiffies(data->update_interval));
+	mutex_unlock(&data->update_lock);
+}
+
+/**
+ * @brief HWMON function sd109 start/stop voltage sampler
+ * @param [in] data driver private data
+ * @details The sampler runs when the overlay sets vin_poll_interval or when
+ * any voltage threshold is set, so that alarms are raised and notified
+ * without a reader. Must be called with update_lock held.
+ */
+static void sd109_vin_sampler_update(struct sd109_private *data)
+{
+	bool run = false;
+	int ch;
+
+	if (data->vin_live) {
+		run = data->vin_poll;
+		for (ch=0; ch<NUM_CH_VIN; ch++) {
+			if (data->vin_lim_min[ch] || data->vin_lim_max[ch])
+				run = true;
+		}
+	}
+
+	if (run == data->vin_sampler)
+		return;
+
+	WRITE_ONCE(data->vin_sampler, run);
+	if (!run) {
+		/* A running sd109_vin_work sees vin_sampler clear and stops */
+		cancel_delayed_work(&data->vin_work);
+		return;
+	}
+
+	/* First sample now, so readers find a fresh snapshot */
+	sd109_update_voltages(data, true, SD109_OP_VIN_SAMPLE);
+	schedule_delayed_work(&data->vin_work,
+				msecs_to_jiffies(data->update_interval));
+}
+
+/**
+ * @brief HWMON function sd109 get voltage
+ * @param [in] dev struct device pointer
+ * @param [in] ch channel
+ * @param [out] val voltage in millivolt
+ * @return 0 if success.
+ * @details Returns the voltage of specific channel, from the voltage
+ * snapshot, in millivolts.
+ */
+static int sd109_get_voltage(struct device *dev, u8 ch, long *val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	ktime_t start = sd109_op_begin(data, SD109_OP_VIN_INPUT);
+	struct sd109_vin_snapshot snap;
+	int ret;
+
+	ret = sd109_get_snapshot(data, &snap, SD109_OP_VIN_INPUT);
+	if (!ret)
+		*val = snap.volt[ch];
+
+	trace_sd109_voltage(dev, SD109_OP_VIN_INPUT, ch, ret ? 0 : *val, ret,
+				ktime_sub(ktime_get(), start));
+	return ret;
+}
+
+/**
+ * @brief HWMON function sd109 get voltage MAX
+ * @param [in] dev struct device pointer
+ * @param [in] ch channel
+ * @param [out] val voltage in millivolt
+ * @return 0 if success.
+ * @details Returns the maximum voltage of specific channel, from the voltage
+ * snapshot, in millivolts.
+ */
+static int sd109_get_voltage_max(struct device *dev, u8 ch, long *val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	ktime_t start = sd109_op_begin(data, SD109_OP_VIN_MAX);
+	struct sd109_vin_snapshot snap;
+	int ret;
+
+	ret = sd109_get_snapshot(data, &snap, SD109_OP_VIN_MAX);
+	if (!ret)
+		*val = snap.volt_max[ch];
+
+	trace_sd109_voltage(dev, SD109_OP_VIN_MAX, ch, ret ? 0 : *val, ret,
+				ktime_sub(ktime_get(), start));
+	return ret;
+}
+
+/**
+ * @brief HWMON function sd109 get voltage MIN
+ * @param [in] dev struct device pointer
+ * @param [in] ch channel
+ * @param [out] val voltage in millivolt
+ * @return 0 if success.
+ * @details Returns the minimum voltage of specific channel, from the voltage
+ * snapshot, in millivolts.
+ */
+static int sd109_get_voltage_min(struct device *dev, u8 ch, long *val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	ktime_t start = sd109_op_begin(data, SD109_OP_VIN_MIN);
+	struct sd109_vin_snapshot snap;
+	int ret;
+
+	ret = sd109_get_snapshot(data, &snap, SD109_OP_VIN_MIN);
+	if (!ret)
+		*val = snap.volt_min[ch];
+
+	trace_sd109_voltage(dev, SD109_OP_VIN_MIN, ch, ret ? 0 : *val, ret,
+				ktime_sub(ktime_get(), start));
+	return ret;
+}
+
+/**
+ * @brief HWMON function sd109 get voltage alarm
+ * @param [in] dev struct device pointer
+ * @param [in] bit alarm bit
+ * @param [out] val 1 if alarm raised
+ * @return 0 if success.
+ * @details Returns the alarm state evaluated at the last sample.
+ */
+static int sd109_get_alarm(struct device *dev, int bit, long *val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	struct sd109_vin_snapshot snap;
+	int ret;
+
+	sd109_op_begin(data, SD109_OP_VIN_ALARM);
+	ret = sd109_get_snapshot(data, &snap, SD109_OP_VIN_ALARM);
+	if (!ret)
+		*val = test_bit(bit, &snap.alarms);
+
+	return ret;
+}
+
+/**
+ * @brief HWMON function sd109 set voltage threshold
+ * @param [in] dev struct device pointer
+ * @param [in] lim threshold array to update
+ * @param [in] ch channel
+ * @param [in] val threshold in millivolt, 0 disables it
+ * @return 0 if success.
+ * @details Stores the threshold and re-evaluates the alarms against the
+ * current snapshot, so a crossing is reported without waiting a new sample.
+ * The sampler is started with the first threshold and stopped with the last.
+ */
+static int sd109_set_limit(struct device *dev, int *lim, int ch, long val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	struct sd109_vin_snapshot snap;
+
+	sd109_op_begin(data, SD109_OP_VIN_LIMIT);
+	sd109_lock(data, SD109_OP_VIN_LIMIT);
+	lim[ch] = clamp_val(val, 0, U16_MAX);
+	snap = data->vin;
+	if (snap.valid)
+		sd109_publish_snapshot(data, &snap);
+	sd109_vin_sampler_update(data);
+	mutex_unlock(&data->update_lock);
+
+	return 0;
+}
+
+/**
+ * @brief HWMON function input read method
+ * @param [in] dev struct device pointer
+ * @param [in] attr attribute
+ * @param [in] channel
+ * @param [out] val pointer
+ * @return 0 if success.
+ * @details Calls the right handler
+ */
+static int sd109_read_in(struct device *dev, u32 attr, int channel, long *val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+
+	if (channel >= NUM_CH_VIN)
+		return -EOPNOTSUPP;
+
+	switch (attr) {
+		case hwmon_in_input:
+			return sd109_get_voltage(dev,channel,val);
+		case hwmon_in_highest:
+			return sd109_get_voltage_max(dev,channel,val);
+		case hwmon_in_lowest:
+			return sd109_get_voltage_min(dev,channel,val);
+		case hwmon_in_max:
+			*val = data->vin_lim_max[channel];
+			return 0;
+		case hwmon_in_min:
+			*val = data->vin_lim_min[channel];
+			return 0;
+		case hwmon_in_max_alarm:
+			return sd109_get_alarm(dev,SD109_ALARM_MAX(channel),val);
+		case hwmon_in_min_alarm:
+			return sd109_get_alarm(dev,SD109_ALARM_MIN(channel),val);
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+
+/**
+ * @brief HWMON function input write method
+ * @param [in] dev struct device pointer
+ * @param [in] attr attribute
+ * @param [in] channel
+ * @param [in] val value
+ * @return 0 if success.
+ * @details Calls the right handler
+ */
+static int sd109_write_in(struct device *dev, u32 attr, int channel, long val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+
+	if (channel >= NUM_CH_VIN)
+		return -EOPNOTSUPP;
+
+	switch (attr) {
+		case hwmon_in_max:
+			return sd109_set_limit(dev,data->vin_lim_max,channel,val);
+		case hwmon_in_min:
+			return sd109_set_limit(dev,data->vin_lim_min,channel,val);
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+
+/**
+ * @brief HWMON function chip read method
+ * @param [in] dev struct device pointer
+ * @param [in] attr attribute
+ * @param [out] val pointer
+ * @return 0 if success.
+ * @details Reports chip wide attributes
+ */
+static int sd109_read_chip(struct device *dev, u32 attr, long *val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+
+	switch (attr) {
+		case hwmon_chip_update_interval:
+			*val = data->update_interval;
+			return 0;
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+
+/**
+ * @brief HWMON function chip write method
+ * @param [in] dev struct device pointer
+ * @param [in] attr attribute
+ * @param [in] val value
+ * @return 0 if success.
+ * @details Sets the snapshot lifetime, or the sampler period when the
+ * background sampler runs. The new period applies immediately.
+ */
+static int sd109_write_chip(struct device *dev, u32 attr, long val)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+
+	switch (attr) {
+		case hwmon_chip_update_interval:
+			val = clamp_val(val, SD109_MIN_UPDATE_INTERVAL,
+						SD109_MAX_UPDATE_INTERVAL);
+			mutex_lock(&data->update_lock);
+			WRITE_ONCE(data->update_interval, val);
+			if (data->vin_sampler)
+				mod_delayed_work(system_wq, &data->vin_work,
+							msecs_to_jiffies(val));
+			mutex_unlock(&data->update_lock);
+			return 0;
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+
+/**
+ * @brief HWMON function read method
+ * @param [in] dev struct device pointer
+ * @param [in] type enum hwmon_sensor_types
+ * @param [in] attr attribute
+ * @param [in] channel
+ * @param [out] val pointer
+ * @return 0 if success.
+ * @details Calls the right handler
+ */
+static int sd109_read(struct device *dev, enum hwmon_sensor_types type,
+			u32 attr, int channel, long *val)
+{
+	switch (type) {
+		case hwmon_chip:
+			return sd109_read_chip(dev, attr, val);
+		case hwmon_in:
+			return sd109_read_in(dev, attr, channel, val);
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+
+/**
+ * @brief HWMON function write method
+ * @param [in] dev struct device pointer
+ * @param [in] type enum hwmon_sensor_types
+ * @param [in] attr attribute
+ * @param [in] channel
+ * @param [in] val value
+ * @return 0 if success.
+ * @details Calls the right handler
+ */
+static int sd109_write(struct device *dev, enum hwmon_sensor_types type,
+			u32 attr, int channel, long val)
+{
+	switch (type) {
+		case hwmon_chip:
+			return sd109_write_chip(dev, attr, val);
+		case hwmon_in:
+			return sd109_write_in(dev, attr, channel, val);
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+
+/**
+ * @brief HWMON function return channel name
+ * @param [in] dev struct device pointer
+ * @param [in] type enum hwmon_sensor_types
+ * @param [in] attr attribute
+ * @param [in] channel
+ * @param [out] str string pointer
+ * @return 0 if success.
+ * @details Returns the label of channel.
+ */
+static int sd109_read_string(struct device *dev, enum hwmon_sensor_types type,
+		       u32 attr, int channel, const char **str)
+{
+	switch (type) {
+		case hwmon_in:
+			switch (attr) {
+				case hwmon_in_label:
+					switch (channel) {
+						case 0:
+							*str = "BOARD 5V";
+							return 0;
+						case 1:
+							*str = "SoC 5V";
+							return 0;
+						case 2:
+							*str = "SoC 3V3";
+							return 0;
+						case 3:
+							*str = "SoC 1V8";
+							return 0;
+						case 4:
+							*str = "Vin 24V";
+							return 0;
+						default:
+							*str = NULL;
+							break;
+					}
+					return -EOPNOTSUPP;
+				default:
+					return -EOPNOTSUPP;
+			}
+		default:
+			return -EOPNOTSUPP;
+	}
+	return -EOPNOTSUPP;
+}
+
+/**
+ * @brief HWMON function return access attribute
+ * @param [in] data unused
+ * @param [in] type enum hwmon_sensor_types
+ * @param [in] attr attribute
+ * @param [in] channel
+ * @return permission.
+ * @details Returns file access permission
+ */
+static umode_t sd109_is_visible(const void *data, enum hwmon_sensor_types type,
+			       u32 attr, int channel)
+{
+	switch (type) {
+		case hwmon_chip:
+			switch (attr) {
+				case hwmon_chip_update_interval:
+					return S_IRUGO|S_IWUSR;
+				default:
+					break;
+			}
+			break;
+		case hwmon_in:
+			switch (attr) {
+				case hwmon_in_input:
+					return S_IRUGO;
+				case hwmon_in_label:
+					return S_IRUGO;
+ 				case hwmon_in_max:
+					return S_IRUGO|S_IWUSR;
+				case hwmon_in_min:
+					return S_IRUGO|S_IWUSR;
+				case hwmon_in_highest:
+					return S_IRUGO;
+				case hwmon_in_lowest:
+					return S_IRUGO;
+				case hwmon_in_max_alarm:
+					return S_IRUGO;
+				case hwmon_in_min_alarm:
+					return S_IRUGO;
+				default:
+					break;
+			}
+			break;
+		default:
+			break;
+	}
+	return 0;
+}
+
+/****************************************************************************
+ * HWMON STRUCTURES
+ ****************************************************************************/
+#define SD109_IN_CONFIG	(HWMON_I_INPUT|HWMON_I_LABEL|HWMON_I_MAX|HWMON_I_MIN|\
+					HWMON_I_HIGHEST|HWMON_I_LOWEST|HWMON_I_MAX_ALARM|HWMON_I_MIN_ALARM)
+
+static const u32 sd109_in_config[] = {
+	SD109_IN_CONFIG,
+	SD109_IN_CONFIG,
+	SD109_IN_CONFIG,
+	SD109_IN_CONFIG,
+	SD109_IN_CONFIG,
+	0
+};
+
+static const u32 sd109_chip_config[] = {
+	HWMON_C_UPDATE_INTERVAL,
+	0
+};
+
+static const struct hwmon_channel_info sd109_chip = {
+	.type = hwmon_chip,
+	.config = sd109_chip_config,
+};
+
+static const struct hwmon_channel_info sd109_voltage = {
+	.type = hwmon_in,
+	.config = sd109_in_config,
+};
+
+static const struct hwmon_channel_info *sd109_info[] = {
+	&sd109_chip,
+	&sd109_voltage,
+	NULL
+};
+
+static const struct hwmon_ops sd109_hwmon_ops = {
+	.is_visible = sd109_is_visible,
+	.read = sd109_read,
+	.write = sd109_write,
+	.read_string = sd109_read_string,
+};
+
+static const struct hwmon_chip_info sd109_chip_info = {
+	.ops = &sd109_hwmon_ops,
+	.info = sd109_info,
+};
+
+/****************************************************************************
+ * WATCHDOG OPS
+ ****************************************************************************/
+
+/**
+ * @brief WATCHDOG function arm pretimeout
+ * @param [in] data driver private data
+ * @details The pretimeout timer expires pretimeout seconds before the MCU
+ * would fire, counted from the last ping sent to the MCU. When the core
+ * emulates a timeout longer than the hardware one, it keeps pinging the MCU
+ * and the pretimeout fires only once those pings stop.
+ */
+static void sd109_wdt_arm_pretimeout(struct sd109_private *data)
+{
+	unsigned int pretimeout = data->wdd.pretimeout;
+	s64 left;
+
+	if (!pretimeout || (pretimeout >= data->wdt_hw_timeout)) {
+		del_timer(&data->wdt_pretimer);
+		return;
+	}
+
+	left = (s64)(data->wdt_hw_timeout - pretimeout)*MSEC_PER_SEC -
+				ktime_ms_delta(ktime_get(), data->wdt_last_ping);
+
+	mod_timer(&data->wdt_pretimer,
+				jiffies + msecs_to_jiffies(max_t(s64, left, 0)));
+}
+
+static void sd109_wdt_pretimeout(struct timer_list *t)
+{
+	struct sd109_private *data = from_timer(data, t, wdt_pretimer);
+
+	watchdog_notify_pretimeout(&data->wdd);
+}
+
+static int sd109_wdt_ping(struct watchdog_device *wdd)
+{
+	struct sd109_private *data = watchdog_get_drvdata(wdd);
+	ktime_t start = sd109_op_begin(data, SD109_OP_WDT_PING);
+	int ret = sd109_reg_write(data, SD109_OP_WDT_PING, SD109_WDOG_REFRESH,
+		SD109_WDOG_REFRESH_MAGIC_VALUE);
+
+	if (!ret) {
+		data->wdt_last_ping = ktime_get();
+		data->wdt_hw_pings++;
+		/* Pings from the core worker are not userspace keepalives */
+		if (!(current->flags & PF_KTHREAD))
+			data->wdt_last_keepalive = data->wdt_last_ping;
+		sd109_wdt_arm_pretimeout(data);
+	}
+
+	trace_sd109_wdt_ping(wdd->parent, ret, ktime_sub(ktime_get(), start));
+	return ret;
+}
+
+static int sd109_wdt_start(struct watchdog_device *wdd)
+{
+	struct sd109_private *data = watchdog_get_drvdata(wdd);
+	int ret;
+
+	sd109_op_begin(data, SD109_OP_WDT_START);
+	ret = sd109_reg_write(data, SD109_OP_WDT_START, SD109_COMMAND,
+				SD109_WDOG_ENABLE);
+
+	if (!ret) {
+		data->wdt_last_ping = ktime_get();
+		data->wdt_last_keepalive = data->wdt_last_ping;
+		sd109_wdt_arm_pretimeout(data);
+	}
+
+	return ret;
+}
+
+static int sd109_wdt_stop(struct watchdog_device *wdd)
+{
+	struct sd109_private *data = watchdog_get_drvdata(wdd);
+	int ret;
+
+	del_timer_sync(&data->wdt_pretimer);
+
+	sd109_op_begin(data, SD109_OP_WDT_STOP);
+	ret = sd109_reg_write(data, SD109_OP_WDT_STOP, SD109_COMMAND,
+				SD109_WDOG_DISABLE);
+
+	return ret;
+}
+
+/**
+ * @brief WATCHDOG function set timeout
+ * @param [in] wdd watchdog device
+ * @param [in] to timeout in seconds
+ * @return 0 if success.
+ * @details The MCU counts up to SD109_WDOG_MAX_HW_TIMEOUT seconds: longer
+ * timeouts are programmed as the hardware maximum and the watchdog core
+ * keeps pinging the MCU until the requested timeout expires.
+ */
+static int sd109_wdt_settimeout(struct watchdog_device *wdd, unsigned int to)
+{
+	struct sd109_private *data = watchdog_get_drvdata(wdd);
+	unsigned int hw_to = min(to, SD109_WDOG_MAX_HW_TIMEOUT);
+	int ret;
+	unsigned int reg;
+
+	if (watchdog_timeout_invalid(wdd, to)) {
+		return -EINVAL;
+	}
+
+	/* build up register value */
+	reg = ((data->wdog_wait/5)<<SD109_WDOG_WAIT_POS)&SD109_WDOG_WAIT_MASK;
+	reg |= (hw_to&SD109_WDOG_TIMEOUT_MASK)<<SD109_WDOG_TIMEOUT_POS;
+
+	sd109_op_begin(data, SD109_OP_WDT_SETTIMEOUT);
+	ret = sd109_reg_write(data, SD109_OP_WDT_SETTIMEOUT, SD109_WDOG_TIMEOUT,
+				reg);
+	if (ret)
+		return ret;
+
+	data->wdt_hw_timeout = hw_to;
+	wdd->timeout = to;
+
+	/* The core leaves the pretimeout to drivers providing set_timeout */
+	if (wdd->pretimeout >= hw_to)
+		wdd->pretimeout = 0;
+
+	if (watchdog_active(wdd))
+		sd109_wdt_arm_pretimeout(data);
+
+	return 0;
+}
+
+static int sd109_wdt_setpretimeout(struct watchdog_device *wdd,
+			unsigned int pretimeout)
+{
+	struct sd109_private *data = watchdog_get_drvdata(wdd);
+
+	if (pretimeout && (pretimeout >= data->wdt_hw_timeout))
+		return -EINVAL;
+
+	wdd->pretimeout = pretimeout;
+
+	if (watchdog_active(wdd))
+		sd109_wdt_arm_pretimeout(data);
+
+	return 0;
+}
+
+/**
+ * @brief WATCHDOG function ioctl hook
+ * @param [in] wdd watchdog device
+ * @param [in] cmd ioctl command
+ * @param [in] arg ioctl argument
+ * @return -ENOIOCTLCMD, the watchdog core handles every command.
+ * @details Records the time of userspace keepalives: the core may defer them
+ * and send the ping to the MCU later from its worker.
+ */
+static long sd109_wdt_ioctl(struct watchdog_device *wdd, unsigned int cmd,
+			unsigned long arg)
+{
+	struct sd109_private *data = watchdog_get_drvdata(wdd);
+
+	if (((cmd == WDIOC_KEEPALIVE) || (cmd == WDIOC_SETTIMEOUT)) &&
+				watchdog_active(wdd))
+		data->wdt_last_keepalive = ktime_get();
+
+	return -ENOIOCTLCMD;
+}
+
+/**
+ * @brief WATCHDOG function get time left
+ * @param [in] wdd watchdog device
+ * @return seconds left before the watchdog fires.
+ * @details Computed without bus access. Up to the MCU timeout it is counted
+ * from the last ping sent to the MCU. Longer timeouts are emulated by core
+ * pings, so it is counted from the last userspace keepalive instead.
+ */
+static unsigned int sd109_wdt_get_timeleft(struct watchdog_device *wdd)
+{
+	struct sd109_private *data = watchdog_get_drvdata(wdd);
+	unsigned int timeout = data->wdt_hw_timeout;
+	ktime_t since = data->wdt_last_ping;
+	s64 elapsed;
+
+	if (!watchdog_active(wdd))
+		return 0;
+
+	if (wdd->timeout > data->wdt_hw_timeout) {
+		timeout = wdd->timeout;
+		since = data->wdt_last_keepalive;
+	}
+
+	elapsed = div_s64(ktime_ms_delta(ktime_get(), since), MSEC_PER_SEC);
+	if (elapsed >= timeout)
+		return 0;
+
+	return timeout - elapsed;
+}
+
+/****************************************************************************
+ * WATCHDOG STRUCTURES
+ ****************************************************************************/
+static const struct watchdog_ops sd109_wdt_ops = {
+	.owner = THIS_MODULE,
+	.start = sd109_wdt_start,
+	.stop = sd109_wdt_stop,
 	.ping = sd109_wdt_ping,
 	.set_timeout	= sd109_wdt_settimeout,
+	.set_pretimeout = sd109_wdt_setpretimeout,
+	.get_timeleft = sd109_wdt_get_timeleft,
+	.ioctl = sd109_wdt_ioctl,
 };
 
-static struct watchdog_info sd109_wdt_info = {
-	.options = WDIOF_KEEPALIVEPING | WDIOF_MAGICCLOSE | WDIOF_SETTIMEOUT,
+static const struct watchdog_info sd109_wdt_info = {
+	.options = WDIOF_KEEPALIVEPING | WDIOF_MAGICCLOSE | WDIOF_SETTIMEOUT |
+				WDIOF_PRETIMEOUT,
 	.identity = "OPEN-EYES sd109 Watchdog",
 };
 
@@ -419,13 +1338,13 @@ static int sd109_wdog_init(struct device *dev)
 {
 	struct sd109_private *data = dev_get_drvdata(dev);
 	int ret;
-	int tinfo;
+	unsigned int tinfo;
 	bool update_device=false;
 
 	watchdog_set_drvdata(&data->wdd, data);
 
 	/* get timeout info from device */
-	ret = regmap_read(data->regmap, SD109_WDOG_TIMEOUT, &tinfo);
+	ret = sd109_reg_read(data, SD109_OP_PROBE, SD109_WDOG_TIMEOUT, &tinfo);
 	if (ret < 0) {
 		dev_err(dev, "failed to read I2C when init watchdog\n");
 		return ret;
@@ -454,331 +1373,1118 @@ static int sd109_wdog_init(struct device *dev)
 		update_device = true;
 	}
 
-	sd109_wdt_info.firmware_version = data->firmware_version;
+	/* Each instance reports its own firmware version */
+	data->wdt_info = sd109_wdt_info;
+	data->wdt_info.firmware_version = data->firmware_version;
 	data->wdd.parent = dev;
 
-	data->wdd.info = &sd109_wdt_info;
+	data->wdd.info = &data->wdt_info;
 	data->wdd.ops = &sd109_wdt_ops;
 
+	/*
+	 * Let the watchdog core rate-limit keepalives and emulate timeouts
+	 * longer than the MCU can count.
+	 */
+	data->wdd.min_timeout = SD109_WDOG_MIN_TIMEOUT;
+	data->wdd.min_hw_heartbeat_ms = SD109_WDOG_MIN_HEARTBEAT_MS;
+	data->wdd.max_hw_heartbeat_ms = SD109_WDOG_MAX_HW_TIMEOUT*MSEC_PER_SEC;
+	data->wdt_hw_timeout = min_t(unsigned int, data->device_wdog_timeout,
+				SD109_WDOG_MAX_HW_TIMEOUT);
+
 	watchdog_set_nowayout(&data->wdd, data->overlay_wdog_nowayout);
 
-	if (update_device)
-		sd109_wdt_settimeout(&data->wdd,data->wdd.timeout);
+	if (update_device) {
+		ret = sd109_wdt_settimeout(&data->wdd,data->wdd.timeout);
+		if (ret == -EINVAL) {
+			dev_warn(dev, "invalid wdog_timeout %u, using device timeout %d\n",
+						data->wdd.timeout, data->device_wdog_timeout);
+			ret = sd109_wdt_settimeout(&data->wdd,data->device_wdog_timeout);
+		}
+		if (ret) {
+			dev_err(dev, "failed to set watchdog timeout\n");
+			return ret;
+		}
+	}
 
 	ret = watchdog_register_device(&data->wdd);
 	if (ret)
 		return ret;
 
-	dev_info(dev, "Watchdog registered!\n");
+	data->wdt_registered = true;
+	dev_info(dev, "Watchdog registered!\n");
+
+	return 0;
+}
+
+/****************************************************************************
+ * RTC OPS
+ ****************************************************************************/
+
+/**
+ * @brief RTC function read 48 bit counter
+ * @param [in] data driver private data
+ * @param [in] op operation, for statistics
+ * @param [in] reg first of the 3 counter registers
+ * @param [out] ticks counter value
+ * @return 0 if success.
+ * @details The counter is split in 3 words of 16 bits, fetched with a single
+ * block transfer. Firmware without register auto-increment (vin_no_block_read)
+ * answers block transfers with the first word repeated, so the words are read
+ * one at a time.
+ */
+static int sd109_read_ticks(struct sd109_private *data, enum sd109_op op,
+			unsigned int reg, time64_t *ticks)
+{
+	u16 words[SD109_RTC_WORDS];
+	unsigned int val;
+	int ret;
+	int i;
+
+	if (!data->vin_no_block_read) {
+		ret = sd109_bulk_read(data, op, reg, words, SD109_RTC_WORDS);
+		if (ret)
+			return ret;
+	} else {
+		for (i=0; i<SD109_RTC_WORDS; i++) {
+			ret = sd109_reg_read(data, op, reg + i, &val);
+			if (ret)
+				return ret;
+			words[i] = val;
+		}
+	}
+
+	*ticks = (time64_t)words[0] | ((time64_t)words[1]<<16) |
+						((time64_t)words[2]<<32);
+	return 0;
+}
+
+/**
+ * @brief RTC function write 48 bit counter
+ * @param [in] data driver private data
+ * @param [in] op operation, for statistics
+ * @param [in] reg first of the 3 counter registers
+ * @param [in] ticks counter value
+ * @return 0 if success.
+ * @details The counter is split in 3 words of 16 bits, written with a single
+ * block transfer. Without register auto-increment the words are written one
+ * at a time: the low word is cleared first, so the running counter cannot
+ * carry into the upper words while they are written, and set last.
+ */
+static int sd109_write_ticks(struct sd109_private *data, enum sd109_op op,
+			unsigned int reg, time64_t ticks)
+{
+	u16 words[SD109_RTC_WORDS];
+	int ret;
+	int i;
+
+	words[0] = ticks & 0xffff;
+	words[1] = (ticks>>16) & 0xffff;
+	words[2] = (ticks>>32) & 0xffff;
+
+	if (!data->vin_no_block_read)
+		return sd109_bulk_write(data, op, reg, words, SD109_RTC_WORDS);
+
+	ret = sd109_reg_write(data, op, reg, 0);
+	for (i=SD109_RTC_WORDS - 1; !ret && (i>=0); i--)
+		ret = sd109_reg_write(data, op, reg + i, words[i]);
+
+	return ret;
+}
+
+/**
+ * @brief RTC function read MCU time
+ * @param [in] data driver private data
+ * @param [out] time seconds read from MCU counter
+ * @return 0 if success.
+ * @details The MCU may carry into the upper words while the counter is being
+ * transferred. The counter is read twice: two values at most one tick apart
+ * are consistent, anything else is a torn read and is retried.
+ */
+static int sd109_rtc_read_counter(struct sd109_private *data, time64_t *time)
+{
+	time64_t first, second;
+	int retry;
+	int ret;
+
+	ret = sd109_read_ticks(data, SD109_OP_RTC_READ, SD109_RTC0, &first);
+	if (ret)
+		return ret;
+
+	for (retry=0; retry<SD109_RTC_READ_RETRIES; retry++) {
+		ret = sd109_read_ticks(data, SD109_OP_RTC_READ, SD109_RTC0, &second);
+		if (ret)
+			return ret;
+
+		if ((second >= first) && (second - first <= 1)) {
+			*time = second;
+			return 0;
+		}
+		first = second;
+	}
+
+	return -EIO;
+}
+
+/**
+ * @brief RTC function set anchor
+ * @param [in] data driver private data
+ * @param [in] time MCU time matching the current boottime
+ * @param [in] measure record drift against the previous anchor
+ * @details Anchors the MCU counter to the boottime clock, used to answer
+ * read_time without bus traffic until the next resync. If an anchor already
+ * exists the drift between extrapolated and MCU time is recorded.
+ */
+static void sd109_rtc_anchor(struct sd109_private *data, time64_t time,
+			bool measure)
+{
+	ktime_t now = ktime_get_boottime();
+	s64 drift;
+
+	if (measure && data->rtc_anchor_valid) {
+		drift = time - (data->rtc_anchor_time +
+			div_s64(ktime_to_ns(ktime_sub(now, data->rtc_anchor_boot)),
+								NSEC_PER_SEC));
+		data->rtc_drift = drift;
+		if (abs(drift) > abs(data->rtc_drift_max))
+			data->rtc_drift_max = drift;
+		data->rtc_resyncs++;
+	}
+
+	data->rtc_anchor_time = time;
+	data->rtc_anchor_boot = now;
+	data->rtc_anchor_valid = true;
+}
+
+static int sd109_rtc_set_time(struct device *dev, struct rtc_time *tm)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	time64_t new_time = rtc_tm_to_time64(tm);
+	ktime_t start = sd109_op_begin(data, SD109_OP_RTC_SET);
+	int ret;
+
+	if (new_time > SD109_RTC_MAX)
+		return -EINVAL;
+
+	ret = sd109_write_ticks(data, SD109_OP_RTC_SET, SD109_RTC0, new_time);
+	trace_sd109_rtc(dev, SD109_OP_RTC_SET, new_time, ret,
+				ktime_sub(ktime_get(), start));
+	if (ret) {
+		dev_err(dev, "Unable to write RTC when setting time\n");
+		return ret;
+	}
+
+	/*
+	 * Always re-anchor: an old anchor would otherwise be extrapolated if
+	 * the resync interval is enabled again later.
+	 */
+	sd109_rtc_anchor(data, new_time, false);
+
+	return 0;
+}
+
+static int sd109_rtc_read_time(struct device *dev, struct rtc_time *tm)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	unsigned int interval = data->rtc_resync_interval;
+	ktime_t start = sd109_op_begin(data, SD109_OP_RTC_READ);
+	time64_t new_time;
+	s64 elapsed;
+	int ret;
+
+	/*
+	 * Serialized by the RTC core ops_lock, so the anchor needs no lock.
+	 * Extrapolate from the anchor while it is younger than the resync
+	 * interval.
+	 */
+	if (interval && data->rtc_anchor_valid) {
+		elapsed = ktime_to_ns(ktime_sub(ktime_get_boottime(),
+						data->rtc_anchor_boot));
+		if (elapsed < (s64)interval * NSEC_PER_SEC) {
+			new_time = data->rtc_anchor_time + div_s64(elapsed, NSEC_PER_SEC);
+			sd109_op_hit(data, SD109_OP_RTC_READ);
+			trace_sd109_rtc(dev, SD109_OP_RTC_READ, new_time, 0,
+						ktime_sub(ktime_get(), start));
+			rtc_time64_to_tm(new_time,tm);
+			return 0;
+		}
+	}
+
+	ret = sd109_rtc_read_counter(data, &new_time);
+	trace_sd109_rtc(dev, SD109_OP_RTC_READ, ret ? 0 : new_time, ret,
+				ktime_sub(ktime_get(), start));
+	if (ret) {
+		dev_err(dev, "Unable to read RTC when getting time\n");
+		return ret;
+	}
+
+	if (interval)
+		sd109_rtc_anchor(data, new_time, true);
+
+	rtc_time64_to_tm(new_time,tm);
+	return 0;
+}
+
+static int sd109_rtc_set_alarm(struct device *dev, struct rtc_wkalrm *alrm)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	time64_t alarm_time = rtc_tm_to_time64(&alrm->time);
+	ktime_t start = sd109_op_begin(data, SD109_OP_ALARM_SET);
+	int ret;
+
+	data->alarm_enabled = alrm->enabled;
+	data->alarm_pending = alrm->pending;
+
+	if (alarm_time > SD109_RTC_MAX)
+		return -EINVAL;
+
+	ret = sd109_write_ticks(data, SD109_OP_ALARM_SET, SD109_WAKEUP0,
+				alarm_time);
+	trace_sd109_rtc(dev, SD109_OP_ALARM_SET, alarm_time, ret,
+				ktime_sub(ktime_get(), start));
+	if (ret) {
+		dev_err(dev, "Unable to write WAKEUP when setting alarm\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+static int sd109_rtc_read_alarm(struct device *dev, struct rtc_wkalrm *alrm)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	time64_t alarm_time;
+	int ret;
+
+	sd109_op_begin(data, SD109_OP_ALARM_READ);
+	ret = sd109_read_ticks(data, SD109_OP_ALARM_READ, SD109_WAKEUP0,
+				&alarm_time);
+	if (ret) {
+		dev_err(dev, "Unable to read WAKEUP when getting alarm\n");
+		return ret;
+	}
+
+	rtc_time64_to_tm(alarm_time,&alrm->time);
+	alrm->enabled = data->alarm_enabled;
+	alrm->pending = data->alarm_pending;
+
+	return 0;
+}
+
+ /*
+  * Interface to RTC framework
+  */
+
+static int sd109_alarm_irq_enable(struct device *dev, unsigned int enabled)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+
+	if (!enabled) {
+		/** When IRQ disabled clear wakeup timer */
+		sd109_op_begin(data, SD109_OP_ALARM_SET);
+		return sd109_write_ticks(data, SD109_OP_ALARM_SET, SD109_WAKEUP0, 0);
+	}
+ 	return 0;
+}
+
+/****************************************************************************
+ * RTC STRUCTURES
+ ****************************************************************************/
+
+static const struct rtc_class_ops sd109_rtc_ops = {
+	.set_time	        = sd109_rtc_set_time,
+	.read_time	      = sd109_rtc_read_time,
+	.read_alarm	      = sd109_rtc_read_alarm,
+	.set_alarm	      = sd109_rtc_set_alarm,
+	.alarm_irq_enable = sd109_alarm_irq_enable,
+};
+
+/****************************************************************************
+ * RTC INITIALIZATION
+ ****************************************************************************/
+static int sd109_rtc_init(struct device *dev)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	u32 val;
+
+	if (!device_property_read_u32(dev, "rtc_resync_interval", &val))
+		data->rtc_resync_interval = val;
+
+	device_init_wakeup(dev, 1);
+
+	data->rtc = devm_rtc_device_register(dev, data->client->name,
+					 &sd109_rtc_ops, THIS_MODULE);
+
+	if (IS_ERR(data->rtc)) {
+		dev_err(dev, "failed register RTC\n");
+		return PTR_ERR(data->rtc);
+	}
+
+	return 0;
+}
+
+/****************************************************************************
+ * VOLTAGE CAPTURE
+ ****************************************************************************/
+
+/**
+ * @brief CAPTURE function sample selected channels
+ * @param [in] data driver private data
+ * @param [in] channels bitmask of channels to sample
+ * @param [out] rec record to fill
+ * @return 0 if success.
+ * @details Reads the input registers of the selected channels, from the
+ * first to the last one, in a single block transfer when supported.
+ */
+static int sd109_capture_sample(struct sd109_private *data,
+			unsigned long channels, struct sd109_vin_record *rec)
+{
+	u16 regs[SD109_VIN_NUM_REGS];
+	unsigned int first = __ffs(channels);
+	unsigned int last = __fls(channels);
+	unsigned int val;
+	int ret;
+	int ch;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->channels = channels;
+
+	if (!data->vin_no_block_read) {
+		ret = sd109_bulk_read(data, SD109_OP_CAPTURE,
+				SD109_VOLTAGE_5V_BOARD + first*SD109_VIN_REGS_PER_CH, regs,
+				(last - first)*SD109_VIN_REGS_PER_CH + 1);
+		rec->timestamp = ktime_get_boottime_ns();
+		if (ret)
+			return ret;
+
+		for_each_set_bit(ch, &channels, NUM_CH_VIN)
+			rec->volt[ch] = regs[(ch - first)*SD109_VIN_REGS_PER_CH];
+		return 0;
+	}
+
+	for_each_set_bit(ch, &channels, NUM_CH_VIN) {
+		ret = sd109_reg_read(data, SD109_OP_CAPTURE,
+				SD109_VOLTAGE_5V_BOARD + ch*SD109_VIN_REGS_PER_CH, &val);
+		if (ret)
+			return ret;
+		rec->volt[ch] = val;
+	}
+	rec->timestamp = ktime_get_boottime_ns();
+
+	return 0;
+}
+
+/**
+ * @brief CAPTURE function sampler thread
+ * @param [in] arg capture state
+ * @return 0
+ * @details Samples back to back, or every capture_period_us, and queues the
+ * records in the capture ring. Records are dropped and counted as overruns
+ * when the reader does not keep up. The thread is frozen on suspend, so it
+ * does not access the bus while the adapter is suspended.
+ */
+static int sd109_capture_thread(void *arg)
+{
+	struct sd109_capture *cap = arg;
+	struct sd109_private *data = cap->data;
+	unsigned long channels = cap->channels;
+	unsigned int period = cap->period_us;
+	struct sd109_vin_record rec;
+
+	set_freezable();
+
+	while (!kthread_freezable_should_stop(NULL)) {
+		sd109_op_begin(data, SD109_OP_CAPTURE);
+		if (sd109_capture_sample(data, channels, &rec)) {
+			cap->errors++;
+			msleep(SD109_CAPTURE_ERROR_DELAY);
+			continue;
+		}
+
+		cap->samples++;
+		if (!kfifo_put(&cap->fifo, rec))
+			cap->overruns++;
+		else
+			wake_up_interruptible(&cap->wait);
+
+		if (period)
+			usleep_range(period, period + period/8);
+		else
+			cond_resched();
+	}
+
+	return 0;
+}
+
+/**
+ * @brief CAPTURE function start/stop
+ * @param [in] cap capture state
+ * @param [in] enable true to start the sampler thread
+ * @return 0 if success.
+ * @details Starting discards the records left from a previous run. Must be
+ * called with cap->lock held.
+ */
+static int sd109_capture_enable(struct sd109_capture *cap, bool enable)
+{
+	struct task_struct *thread;
+
+	if (enable == !!cap->thread)
+		return 0;
+
+	if (!enable) {
+		kthread_stop(cap->thread);
+		WRITE_ONCE(cap->thread, NULL);
+		wake_up_interruptible(&cap->wait);
+		return 0;
+	}
+
+	kfifo_reset(&cap->fifo);
+	cap->samples = 0;
+	cap->overruns = 0;
+	cap->errors = 0;
+
+	/* One thread per instance: the name fits TASK_COMM_LEN with the device */
+	thread = kthread_run(sd109_capture_thread, cap, "sd109c/%s",
+				dev_name(&cap->data->client->dev));
+	if (IS_ERR(thread))
+		return PTR_ERR(thread);
+
+	WRITE_ONCE(cap->thread, thread);
+	return 0;
+}
+
+/**
+ * @brief CAPTURE function free capture state
+ * @param [in] ref reference counter
+ * @details Called when both the device and every open file are gone.
+ */
+static void sd109_capture_free(struct kref *ref)
+{
+	struct sd109_capture *cap = container_of(ref, struct sd109_capture, ref);
+
+	kfifo_free(&cap->fifo);
+	kfree(cap->misc.name);
+	kfree(cap);
+}
+
+static int sd109_capture_open(struct inode *inode, struct file *file)
+{
+	struct sd109_capture *cap = container_of(file->private_data,
+				struct sd109_capture, misc);
+
+	/* The ring must survive the device while this file is open */
+	kref_get(&cap->ref);
+
+	return 0;
+}
+
+static int sd109_capture_release(struct inode *inode, struct file *file)
+{
+	struct sd109_capture *cap = container_of(file->private_data,
+				struct sd109_capture, misc);
+
+	kref_put(&cap->ref, sd109_capture_free);
+
+	return 0;
+}
+
+static ssize_t sd109_capture_read(struct file *file, char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	struct sd109_capture *cap = container_of(file->private_data,
+				struct sd109_capture, misc);
+	unsigned int copied;
+	int ret;
+
+	if (count < sizeof(struct sd109_vin_record))
+		return -EINVAL;
+
+	do {
+		if (kfifo_is_empty(&cap->fifo)) {
+			/* Capture stopped and ring drained: end of file */
+			if (!READ_ONCE(cap->thread))
+				return 0;
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(cap->wait,
+						!kfifo_is_empty(&cap->fifo) ||
+						!READ_ONCE(cap->thread));
+			if (ret)
+				return ret;
+		}
+
+		/* Serializes readers, and readers against kfifo_reset */
+		if (mutex_lock_interruptible(&cap->lock))
+			return -ERESTARTSYS;
+		ret = kfifo_to_user(&cap->fifo, buf, count, &copied);
+		mutex_unlock(&cap->lock);
+		if (ret)
+			return ret;
+	} while (!copied);
 
-	return 0;
+	return copied;
 }
 
-/****************************************************************************
- * RTC OPS
- ****************************************************************************/
-
-static int sd109_rtc_set_time(struct device *dev, struct rtc_time *tm)
+static __poll_t sd109_capture_poll(struct file *file, poll_table *wait)
 {
- 	struct sd109_private *data = dev_get_drvdata(dev);
- 	time64_t new_time = rtc_tm_to_time64(tm);
-	int ret;
-	unsigned int tick;
+	struct sd109_capture *cap = container_of(file->private_data,
+				struct sd109_capture, misc);
 
-	if (new_time > 0x0000ffffffffffff)
- 		return -EINVAL;
+	poll_wait(file, &cap->wait, wait);
 
- 	/*
- 	 * The value to write is divided in 3 words of 16 bits
- 	 * and written into the sd109 firmware
- 	 */
-
-	tick = new_time & 0xffff;
-	ret = regmap_write(data->regmap, SD109_RTC0,	tick);
-	if (ret) {
-		dev_err(dev, "Unable to write RTC word 0 when setting time\n");
-		return ret;
-	}
+	if (!kfifo_is_empty(&cap->fifo))
+		return EPOLLIN | EPOLLRDNORM;
 
-	tick = (new_time>>16) & 0xffff;
-	ret = regmap_write(data->regmap, SD109_RTC1,	tick);
-	if (ret) {
-		dev_err(dev, "Unable to write RTC word 1 when setting time\n");
-		return ret;
-	}
+	/* Nothing more will come until capture is enabled again */
+	if (!READ_ONCE(cap->thread))
+		return EPOLLHUP;
 
-	tick = (new_time>>32) & 0xffff;
-	ret = regmap_write(data->regmap, SD109_RTC2,	tick);
-	if (ret) {
-		dev_err(dev, "Unable to write RTC word 2 when setting time\n");
-		return ret;
-	}
+	return 0;
+}
 
- 	return 0;
- }
+static const struct file_operations sd109_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = sd109_capture_open,
+	.release = sd109_capture_release,
+	.read = sd109_capture_read,
+	.poll = sd109_capture_poll,
+	.llseek = noop_llseek,
+};
 
-static int sd109_rtc_read_time(struct device *dev, struct rtc_time *tm)
+static ssize_t capture_enable_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
 {
 	struct sd109_private *data = dev_get_drvdata(dev);
-	time64_t new_time,snap_time;
- 	int ret;
- 	unsigned int tick;
 
-	/*
-	* The value to read is divided in 3 words of 16 bits
-	* and read from the sd109 firmware
-	*/
+	return sprintf(buf, "%d\n", !!data->cap->thread);
+}
 
-	ret = regmap_read(data->regmap, SD109_RTC0,	&tick);
-	if (ret) {
-		dev_err(dev, "Unable to read RTC word 0 when getting time\n");
-		return ret;
-	}
-	snap_time = tick&0xffff;
-	new_time = snap_time;
+static ssize_t capture_enable_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	struct sd109_capture *cap = data->cap;
+	bool enable;
+	int ret;
 
-	ret = regmap_read(data->regmap, SD109_RTC1,	&tick);
-	if (ret) {
-		dev_err(dev, "Unable to read RTC word 1 when getting time\n");
+	ret = kstrtobool(buf, &enable);
+	if (ret)
 		return ret;
-	}
-	snap_time = tick&0xffff;
-	new_time = new_time | (snap_time<<16);
 
-	ret = regmap_read(data->regmap, SD109_RTC2,	&tick);
-	if (ret) {
-		dev_err(dev, "Unable to read RTC word 2 when getting time\n");
-		return ret;
-	}
-	snap_time = tick&0xffff;
-	new_time = new_time | (snap_time<<32);
+	mutex_lock(&cap->lock);
+	ret = sd109_capture_enable(cap, enable);
+	mutex_unlock(&cap->lock);
 
-	rtc_time64_to_tm(new_time,tm);
-	return 0;
+	return ret ? ret : count;
 }
+static DEVICE_ATTR_RW(capture_enable);
 
-static int sd109_rtc_set_alarm(struct device *dev, struct rtc_wkalrm *alrm)
+static ssize_t capture_channels_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
 {
 	struct sd109_private *data = dev_get_drvdata(dev);
-  time64_t alarm_time = rtc_tm_to_time64(&alrm->time);
- 	int ret;
- 	unsigned int tick;
 
-	data->alarm_enabled = alrm->enabled;
-	data->alarm_pending = alrm->pending;
+	return sprintf(buf, "0x%02lx\n", data->cap->channels);
+}
 
- 	if (alarm_time > 0x0000ffffffffffff)
-  		return -EINVAL;
+static ssize_t capture_channels_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	struct sd109_capture *cap = data->cap;
+	unsigned long channels;
+	int ret;
 
-	/*
-	 * The value to write is divided in 3 words of 16 bits
-	 * and written into the sd109 firmware
-	 */
+	ret = kstrtoul(buf, 0, &channels);
+	if (ret)
+		return ret;
 
- 	tick = alarm_time & 0xffff;
- 	ret = regmap_write(data->regmap, SD109_WAKEUP0,	tick);
- 	if (ret) {
- 		dev_err(dev, "Unable to write WAKEUP word 0 when setting alarm\n");
- 		return ret;
- 	}
+	if (!channels || (channels & ~GENMASK(NUM_CH_VIN - 1, 0)))
+		return -EINVAL;
 
- 	tick = (alarm_time>>16) & 0xffff;
- 	ret = regmap_write(data->regmap, SD109_WAKEUP1,	tick);
- 	if (ret) {
- 		dev_err(dev, "Unable to write WAKEUP word 1 when setting alarm\n");
- 		return ret;
- 	}
+	mutex_lock(&cap->lock);
+	if (cap->thread)
+		ret = -EBUSY;
+	else
+		cap->channels = channels;
+	mutex_unlock(&cap->lock);
 
- 	tick = (alarm_time>>32) & 0xffff;
- 	ret = regmap_write(data->regmap, SD109_WAKEUP2,	tick);
- 	if (ret) {
- 		dev_err(dev, "Unable to write WAKEUP word 2 when setting alarm\n");
- 		return ret;
- 	}
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(capture_channels);
 
-  return 0;
+static ssize_t capture_period_us_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
 
+	return sprintf(buf, "%u\n", data->cap->period_us);
 }
 
-static int sd109_rtc_read_alarm(struct device *dev, struct rtc_wkalrm *alrm)
+static ssize_t capture_period_us_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t count)
 {
 	struct sd109_private *data = dev_get_drvdata(dev);
- 	time64_t alarm_time,snap_time;
-  int ret;
-  unsigned int tick;
-
- 	/*
- 	* The value to read is divided in 3 words of 16 bits
- 	* and read from the sd109 firmware
- 	*/
-
- 	ret = regmap_read(data->regmap, SD109_WAKEUP0,	&tick);
- 	if (ret) {
- 		dev_err(dev, "Unable to read RTC word 0 when getting alarm\n");
- 		return ret;
- 	}
- 	snap_time = tick&0xffff;
- 	alarm_time = snap_time;
-
- 	ret = regmap_read(data->regmap, SD109_WAKEUP1,	&tick);
- 	if (ret) {
- 		dev_err(dev, "Unable to read RTC word 1 when getting alarm\n");
- 		return ret;
- 	}
- 	snap_time = tick&0xffff;
- 	alarm_time = alarm_time | (snap_time<<16);
-
- 	ret = regmap_read(data->regmap, SD109_WAKEUP2,	&tick);
- 	if (ret) {
- 		dev_err(dev, "Unable to read RTC word 2 when getting alarm\n");
- 		return ret;
- 	}
- 	snap_time = tick&0xffff;
- 	alarm_time = alarm_time | (snap_time<<32);
-
- 	rtc_time64_to_tm(alarm_time,&alrm->time);
-	alrm->enabled = data->alarm_enabled;
-	alrm->pending = data->alarm_pending;
+	struct sd109_capture *cap = data->cap;
+	unsigned int period;
+	int ret;
 
- 	return 0;
-}
+	ret = kstrtouint(buf, 0, &period);
+	if (ret)
+		return ret;
 
- /*
-  * Interface to RTC framework
-  */
+	mutex_lock(&cap->lock);
+	if (cap->thread)
+		ret = -EBUSY;
+	else
+		cap->period_us = period;
+	mutex_unlock(&cap->lock);
 
-static int sd109_alarm_irq_enable(struct device *dev, unsigned int enabled)
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(capture_period_us);
+
+static ssize_t capture_stats_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
 {
 	struct sd109_private *data = dev_get_drvdata(dev);
+	struct sd109_capture *cap = data->cap;
 
-	if (!enabled) {
-		/** When IRQ disabled clear wakeup timer */
-		regmap_write(data->regmap, SD109_WAKEUP0,	0);
-		regmap_write(data->regmap, SD109_WAKEUP1,	0);
-		regmap_write(data->regmap, SD109_WAKEUP2,	0);
-	}
- 	return 0;
+	return sprintf(buf, "samples %llu\noverruns %llu\nerrors %llu\n",
+				cap->samples, cap->overruns, cap->errors);
 }
+static DEVICE_ATTR_RO(capture_stats);
 
-/****************************************************************************
- * RTC STRUCTURES
- ****************************************************************************/
+static struct attribute *sd109_capture_attrs[] = {
+	&dev_attr_capture_enable.attr,
+	&dev_attr_capture_channels.attr,
+	&dev_attr_capture_period_us.attr,
+	&dev_attr_capture_stats.attr,
+	NULL
+};
 
-static const struct rtc_class_ops sd109_rtc_ops = {
-	.set_time	        = sd109_rtc_set_time,
-	.read_time	      = sd109_rtc_read_time,
-	.read_alarm	      = sd109_rtc_read_alarm,
-	.set_alarm	      = sd109_rtc_set_alarm,
-	.alarm_irq_enable = sd109_alarm_irq_enable,
+static const struct attribute_group sd109_capture_group = {
+	.attrs = sd109_capture_attrs,
 };
 
 /****************************************************************************
- * RTC INITIALIZATION
+ * CAPTURE INITIALIZATION
  ****************************************************************************/
-static int sd109_rtc_init(struct device *dev)
+
+/**
+ * @brief CAPTURE function init
+ * @param [in] dev struct device pointer
+ * @return 0 if success.
+ * @details The capture state is refcounted, with one reference held by the
+ * device and one by every open file, so that a reader can outlive the device.
+ */
+static int sd109_capture_init(struct device *dev)
 {
 	struct sd109_private *data = dev_get_drvdata(dev);
+	struct sd109_capture *cap;
+	u32 depth = SD109_DEF_CAPTURE_DEPTH;
+	int ret;
 
-	device_init_wakeup(dev, 1);
+	device_property_read_u32(dev, "capture_depth", &depth);
 
-	data->rtc = devm_rtc_device_register(dev, data->client->name,
-					 &sd109_rtc_ops, THIS_MODULE);
+	cap = kzalloc(sizeof(*cap), GFP_KERNEL);
+	if (!cap)
+		return -ENOMEM;
 
-	if (IS_ERR(data->rtc)) {
-		dev_err(dev, "failed register RTC\n");
-		return PTR_ERR(data->rtc);
+	kref_init(&cap->ref);
+	cap->data = data;
+	mutex_init(&cap->lock);
+	init_waitqueue_head(&cap->wait);
+	cap->channels = GENMASK(NUM_CH_VIN - 1, 0);
+
+	ret = kfifo_alloc(&cap->fifo, depth, GFP_KERNEL);
+	if (ret)
+		goto put;
+
+	cap->misc.minor = MISC_DYNAMIC_MINOR;
+	cap->misc.name = kasprintf(GFP_KERNEL, "sd109-capture-%s", dev_name(dev));
+	if (!cap->misc.name) {
+		ret = -ENOMEM;
+		goto put;
 	}
+	cap->misc.fops = &sd109_capture_fops;
+	cap->misc.parent = dev;
+
+	ret = misc_register(&cap->misc);
+	if (ret)
+		goto put;
+
+	/* Removed by hand in sd109_capture_remove, before the sampler stops */
+	data->cap = cap;
+	ret = device_add_group(dev, &sd109_capture_group);
+	if (ret) {
+		data->cap = NULL;
+		misc_deregister(&cap->misc);
+		goto put;
+	}
+
+	dev_info(dev, "voltage capture registered as %s\n", cap->misc.name);
 
 	return 0;
+
+put:
+	kref_put(&cap->ref, sd109_capture_free);
+	return ret;
+}
+
+/**
+ * @brief CAPTURE function remove
+ * @param [in] dev struct device pointer
+ * @details Stops the sampler and drops the device reference. Open files keep
+ * reading the records left in the ring, then get end of file.
+ */
+static void sd109_capture_remove(struct device *dev)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	struct sd109_capture *cap = data->cap;
+
+	if (!cap)
+		return;
+
+	device_remove_group(dev, &sd109_capture_group);
+	mutex_lock(&cap->lock);
+	sd109_capture_enable(cap, false);
+	cap->data = NULL;
+	mutex_unlock(&cap->lock);
+	misc_deregister(&cap->misc);
+
+	data->cap = NULL;
+	kref_put(&cap->ref, sd109_capture_free);
 }
 
 /****************************************************************************
  * REBOOT / SHUTDOWN NOTIFY
  ****************************************************************************/
 
-static int sd109_notify_reboot(struct notifier_block *this,
+static int sd109_notify_reboot(struct notifier_block *nb,
 			unsigned long code, void *x)
 {
-	struct sd109_private *data = notify_data;
+	struct sd109_private *data = container_of(nb, struct sd109_private,
+				reboot_nb);
 	int ret=0;
 
+	sd109_op_begin(data, SD109_OP_REBOOT);
+
 	switch (code) {
 		case SYS_POWER_OFF:
-			ret = regmap_write(data->regmap, SD109_COMMAND,	SD109_EXEC_POWEROFF);
+			ret = sd109_reg_write(data, SD109_OP_REBOOT, SD109_COMMAND,
+						SD109_EXEC_POWEROFF);
 			break;
 		case SYS_RESTART:
-			ret = regmap_write(data->regmap, SD109_COMMAND,	SD109_EXEC_REBOOT);
+			ret = sd109_reg_write(data, SD109_OP_REBOOT, SD109_COMMAND,
+						SD109_EXEC_REBOOT);
 			break;
 		case SYS_HALT:
-			ret = regmap_write(data->regmap, SD109_COMMAND,	SD109_EXEC_HALT);
+			ret = sd109_reg_write(data, SD109_OP_REBOOT, SD109_COMMAND,
+						SD109_EXEC_HALT);
 			break;
 	}
 	if (ret)
-		printk(KERN_INFO "Unable to write shutdown command");
+		dev_err(&data->client->dev, "Unable to write shutdown command\n");
 
 	return NOTIFY_DONE;
 }
 
-static struct notifier_block sd109_notifier = {
-	.notifier_call	= sd109_notify_reboot,
-	.next		= NULL,
-	.priority	= 0,
+/****************************************************************************
+ * DEBUGFS
+ ****************************************************************************/
+static int sd109_rtc_drift_show(struct seq_file *s, void *unused)
+{
+	struct sd109_private *data = s->private;
+
+	seq_printf(s, "resyncs:   %llu\n", data->rtc_resyncs);
+	seq_printf(s, "last (s):  %lld\n", data->rtc_drift);
+	seq_printf(s, "max (s):   %lld\n", data->rtc_drift_max);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sd109_rtc_drift);
+
+static void sd109_show_hist(struct seq_file *s, const char *name,
+			atomic64_t *hist)
+{
+	int i;
+
+	seq_printf(s, "  %-5s", name);
+	for (i=0; i<SD109_HIST_BUCKETS; i++)
+		seq_printf(s, " %8llu", (u64)atomic64_read(&hist[i]));
+	seq_puts(s, "\n");
+}
+
+static void sd109_show_hist_header(struct seq_file *s)
+{
+	int i;
+
+	seq_puts(s, "latency histograms, bucket lower bound in us\n       ");
+	for (i=0; i<SD109_HIST_BUCKETS; i++)
+		seq_printf(s, " %8u", i ? 1U << (i - 1) : 0);
+	seq_puts(s, "\n");
+}
+
+static int sd109_ops_show(struct seq_file *s, void *unused)
+{
+	struct sd109_private *data = s->private;
+	struct sd109_op_stats *ops;
+	int op;
+
+	seq_printf(s, "%-16s %10s %10s %10s %10s %10s\n", "operation", "calls",
+				"xfers", "errors", "hits", "misses");
+	for (op=0; op<SD109_OP_NUM; op++) {
+		ops = &data->op_stats[op];
+		seq_printf(s, "%-16s %10llu %10llu %10llu %10llu %10llu\n",
+					sd109_op_names[op], (u64)atomic64_read(&ops->calls),
+					(u64)atomic64_read(&ops->xfers), (u64)atomic64_read(&ops->errors),
+					(u64)atomic64_read(&ops->cache_hits),
+					(u64)atomic64_read(&ops->cache_misses));
+	}
+
+	seq_puts(s, "\n");
+	sd109_show_hist_header(s);
+	for (op=0; op<SD109_OP_NUM; op++) {
+		ops = &data->op_stats[op];
+		if (!atomic64_read(&ops->calls))
+			continue;
+		seq_printf(s, "%s\n", sd109_op_names[op]);
+		sd109_show_hist(s, "bus", ops->bus_hist);
+		sd109_show_hist(s, "lock", ops->lock_hist);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sd109_ops);
+
+static int sd109_registers_show(struct seq_file *s, void *unused)
+{
+	struct sd109_private *data = s->private;
+	struct sd109_reg_stats *regs;
+	int reg;
+
+	seq_printf(s, "%-6s %10s %10s %10s %10s\n", "reg", "reads", "writes",
+				"errors", "hits");
+	for (reg=0; reg<SD109_NUM_REGS; reg++) {
+		regs = &data->reg_stats[reg];
+		seq_printf(s, "0x%02x   %10llu %10llu %10llu %10llu\n", reg,
+					(u64)atomic64_read(&regs->reads),
+					(u64)atomic64_read(&regs->writes),
+					(u64)atomic64_read(&regs->errors),
+					(u64)atomic64_read(&regs->cache_hits));
+	}
+
+	seq_puts(s, "\n");
+	sd109_show_hist_header(s);
+	for (reg=0; reg<SD109_NUM_REGS; reg++) {
+		regs = &data->reg_stats[reg];
+		if (!atomic64_read(&regs->reads) && !atomic64_read(&regs->writes))
+			continue;
+		seq_printf(s, "0x%02x\n", reg);
+		sd109_show_hist(s, "bus", regs->bus_hist);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sd109_registers);
+
+static void sd109_stats_clear(atomic64_t *counters, size_t size)
+{
+	size_t i;
+
+	for (i=0; i<size/sizeof(atomic64_t); i++)
+		atomic64_set(&counters[i], 0);
+}
+
+static ssize_t sd109_reset_write(struct file *file, const char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	struct sd109_private *data = file->private_data;
+	struct sd109_capture *cap = data->cap;
+
+	sd109_stats_clear((atomic64_t *)data->op_stats, sizeof(data->op_stats));
+	sd109_stats_clear((atomic64_t *)data->reg_stats, sizeof(data->reg_stats));
+
+	mutex_lock(&data->update_lock);
+	data->vin_xfers = 0;
+	mutex_unlock(&data->update_lock);
+
+	/* The RTC anchor is serialized by the RTC core ops_lock */
+	if (!IS_ERR_OR_NULL(data->rtc))
+		mutex_lock(&data->rtc->ops_lock);
+	data->rtc_drift = 0;
+	data->rtc_drift_max = 0;
+	data->rtc_resyncs = 0;
+	if (!IS_ERR_OR_NULL(data->rtc))
+		mutex_unlock(&data->rtc->ops_lock);
+
+	data->wdt_hw_pings = 0;
+
+	/* Bumped by a running capture thread, which takes no lock */
+	if (cap) {
+		cap->samples = 0;
+		cap->overruns = 0;
+		cap->errors = 0;
+	}
+
+	return count;
+}
+
+static const struct file_operations sd109_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = sd109_reset_write,
+	.llseek = noop_llseek,
 };
 
+static void sd109_debugfs_init(struct sd109_private *data)
+{
+	data->debugfs = debugfs_create_dir(dev_name(&data->client->dev),
+				sd109_debugfs_root);
+
+	/* I2C transactions spent refreshing the voltage snapshot */
+	debugfs_create_u64("vin_xfers", 0444, data->debugfs, &data->vin_xfers);
+	/* Write 0 to try block reads again */
+	debugfs_create_bool("vin_no_block_read", 0644, data->debugfs,
+				&data->vin_no_block_read);
+
+	/* Keepalives actually sent to the MCU */
+	debugfs_create_u64("wdt_hw_pings", 0444, data->debugfs,
+				&data->wdt_hw_pings);
+
+	/* RTC extrapolation: 0 reads the MCU on every read_time */
+	debugfs_create_u32("rtc_resync_interval", 0644, data->debugfs,
+				&data->rtc_resync_interval);
+	debugfs_create_file("rtc_drift", 0444, data->debugfs, data,
+				&sd109_rtc_drift_fops);
+
+	/* Per operation and per register counters, any write to reset clears */
+	debugfs_create_file("ops", 0444, data->debugfs, data, &sd109_ops_fops);
+	debugfs_create_file("registers", 0444, data->debugfs, data,
+				&sd109_registers_fops);
+	debugfs_create_file("reset", 0200, data->debugfs, data,
+				&sd109_reset_fops);
+}
+
 /****************************************************************************
  * SD109 PROBE
  ****************************************************************************/
-int sd109_probe(struct i2c_client *client, struct regmap *regmap)
+static void sd109_read_limits(struct device *dev, const char *name, int *lim,
+			int def)
+{
+	u32 val[NUM_CH_VIN];
+	int ch;
+
+	if (device_property_read_u32_array(dev, name, val, NUM_CH_VIN)) {
+		for (ch=0; ch<NUM_CH_VIN; ch++)
+			lim[ch] = def;
+		return;
+	}
+
+	for (ch=0; ch<NUM_CH_VIN; ch++)
+		lim[ch] = clamp_val(val[ch], 0, U16_MAX);
+}
+
+/**
+ * @brief SD109 read identification block
+ * @param [in] data driver private data
+ * @param [out] id chip id, firmware version and status
+ * @return 0 if success.
+ * @details Chip id, version and status are contiguous and fetched with a
+ * single transfer. The raw read bypasses the register cache, which would
+ * otherwise split the block in single register reads.
+ */
+static int sd109_read_id_block(struct sd109_private *data,
+			u16 id[SD109_ID_BLOCK_REGS])
+{
+	__be16 raw[SD109_ID_BLOCK_REGS];
+	ktime_t start = sd109_op_begin(data, SD109_OP_PROBE);
+	int ret;
+	int i;
+
+	sd109_access_begin(data);
+	regcache_cache_bypass(data->regmap, true);
+	ret = regmap_raw_read(data->regmap, SD109_CHIP_ID_REG, raw, sizeof(raw));
+	regcache_cache_bypass(data->regmap, false);
+	sd109_access_end(data, SD109_OP_PROBE, SD109_CHIP_ID_REG,
+				SD109_ID_BLOCK_REGS, false, ret, ktime_sub(ktime_get(), start));
+	if (ret)
+		return ret;
+
+	for (i=0; i<SD109_ID_BLOCK_REGS; i++)
+		id[i] = be16_to_cpu(raw[i]);
+
+	return 0;
+}
+
+static int sd109_probe(struct i2c_client *client,
+			struct regmap_config *config)
 {
 	struct device *dev = &client->dev;
 	struct sd109_private *data;
 	struct device *hwmon_dev;
+	u16 id[SD109_ID_BLOCK_REGS];
 	unsigned int val;
 	int ret;
 
-	if (IS_ERR(regmap))
-		return PTR_ERR(regmap);
+	/* The regmap bus issues plain I2C transfers */
+	if (!i2c_check_functionality(client->adapter, I2C_FUNC_I2C))
+		return -EOPNOTSUPP;
 
 	data = devm_kzalloc(dev, sizeof(struct sd109_private),GFP_KERNEL);
 	if (!data)
 		return -ENOMEM;
 
-	notify_data = data;
+	data->client = client;
+	mutex_init(&data->bus_lock);
+
+	/*
+	 * Firmware without register auto-increment answers block reads with
+	 * wrong data instead of an error: it must be declared in the overlay.
+	 * Block writes, such as regcache_sync of the wakeup registers on
+	 * resume, are split as well.
+	 */
+	data->vin_no_block_read = device_property_read_bool(dev,
+				"vin_no_block_read");
+	config->use_single_write = data->vin_no_block_read;
+
+	config->lock = sd109_regmap_lock;
+	config->unlock = sd109_regmap_unlock;
+	config->lock_arg = data;
+	data->regmap = devm_regmap_init(dev, &sd109_regmap_bus, data, config);
+	if (IS_ERR(data->regmap))
+		return PTR_ERR(data->regmap);
 
 	dev_set_drvdata(dev, data);
 
 	mutex_init(&data->update_lock);
-
-	/* Verify that we have a sd109 */
-	ret = regmap_read(regmap, SD109_CHIP_ID_REG, &val);
+	seqlock_init(&data->vin_lock);
+	INIT_DELAYED_WORK(&data->vin_work, sd109_vin_work);
+	timer_setup(&data->wdt_pretimer, sd109_wdt_pretimeout, 0);
+	data->update_interval = SD109_DEF_UPDATE_INTERVAL;
+
+	/* Default voltage thresholds, 0 disables the check */
+	sd109_read_limits(dev, "vin_min", data->vin_lim_min, 0);
+	sd109_read_limits(dev, "vin_max", data->vin_lim_max, 0);
+	sd109_read_limits(dev, "vin_hyst", data->vin_hyst, SD109_DEF_VIN_HYST);
+
+	/* Get chip id, version and status at once */
+	ret = sd109_read_id_block(data, id);
 	if (ret < 0) {
 		dev_err(dev, "failed to read I2C chip Id\n");
 		goto error;
 	}
 
-	if (val!=SD109_CHIP_ID) {
-		dev_err(dev, "Invalid chip id: %x\n", val);
+	/* Verify that we have a sd109 */
+	if (id[SD109_CHIP_ID_REG]!=SD109_CHIP_ID) {
+		dev_err(dev, "Invalid chip id: %x\n", id[SD109_CHIP_ID_REG]);
 		ret = -ENODEV;
 		goto error;
 	}
 
-	/* Get version */
-	ret = regmap_read(regmap, SD109_CHIP_VER_REG, &val);
-	if (ret < 0) {
-		dev_err(dev, "failed to read I2C firmware version\n");
-		goto error;
-	}
-
-	data->regmap = regmap;
+	data->firmware_version = id[SD109_CHIP_VER_REG];
 
-	data->firmware_version = val;
-
-	/* Get status */
-	ret = regmap_read(regmap, SD109_STATUS, &val);
-	if (ret < 0) {
-		dev_err(dev, "failed to access device when reading status\n");
-		goto error;
-	}
+	val = id[SD109_STATUS];
 	switch (val) {
 		case SD109_STATUS_POWERUP:
 			dev_info(dev, "start from POWER-UP");
@@ -808,8 +2514,17 @@ int sd109_probe(struct i2c_client *client, struct regmap *regmap)
 		goto error;
 	}
 
+	data->hwmon_dev = hwmon_dev;
+
 	dev_info(dev, "HWMON registered as %s\n",dev_name(hwmon_dev));
 
+	/* Like update_interval, 0 keeps the sampler off */
+	if (!device_property_read_u32(dev, "vin_poll_interval", &val) && val) {
+		data->update_interval = clamp_val(val, SD109_MIN_UPDATE_INTERVAL,
+						SD109_MAX_UPDATE_INTERVAL);
+		data->vin_poll = true;
+	}
+
 	if (device_property_read_bool(dev, "wdog_enabled")) {
 		if (device_property_read_bool(dev, "wdog_nowayout"))
 			data->overlay_wdog_nowayout = true;
@@ -833,11 +2548,30 @@ int sd109_probe(struct i2c_client *client, struct regmap *regmap)
 		sd109_rtc_init(dev);
 	}
 
+	/* Capture is a diagnostic feature, the driver works without it */
+	ret = sd109_capture_init(dev);
+	if (ret)
+		dev_warn(dev, "voltage capture not available (%d)\n", ret);
+
+	/*
+	 * Register the per device notifier to reboot notifier list so that
+	 * every MCU receives the power command when the system enters S5.
+	 */
+	data->reboot_nb.notifier_call = sd109_notify_reboot;
+	register_reboot_notifier(&data->reboot_nb);
+
+	sd109_debugfs_init(data);
+
 	/*
-	 * Register the tts_notifier to reboot notifier list so that the _TTS
-	 * object can also be evaluated when the system enters S5.
+	 * Allow the background sampler last, so no error path has to stop it:
+	 * threshold writes before this point do not start it.
 	 */
-	register_reboot_notifier(&sd109_notifier);
+	mutex_lock(&data->update_lock);
+	data->vin_live = true;
+	sd109_vin_sampler_update(data);
+	if (data->vin_sampler)
+		dev_info(dev, "voltage sampler every %d ms\n", data->update_interval);
+	mutex_unlock(&data->update_lock);
 
 	return 0;
 
@@ -853,9 +2587,9 @@ static int sd109_i2c_probe(struct i2c_client *client,
 	config = sd109_regmap_config;
 	config.val_bits = 16;
 	config.reg_bits = 8;
-	config.cache_type = REGCACHE_NONE;
+	config.cache_type = REGCACHE_RBTREE;
 
-	return sd109_probe(client,devm_regmap_init_i2c(client, &config));
+	return sd109_probe(client, &config);
 }
 
 static int sd109_remove(struct i2c_client *client)
@@ -863,21 +2597,91 @@ static int sd109_remove(struct i2c_client *client)
 	struct device *dev = &client->dev;
 	struct sd109_private *data = dev_get_drvdata(dev);
 
-	watchdog_unregister_device(&data->wdd);
-	unregister_reboot_notifier(&sd109_notifier);
+	sd109_capture_remove(dev);
+	/*
+	 * The hwmon device outlives remove: stop the sampler for good first so
+	 * that update_interval and threshold writes cannot queue it again.
+	 */
+	mutex_lock(&data->update_lock);
+	data->vin_live = false;
+	sd109_vin_sampler_update(data);
+	mutex_unlock(&data->update_lock);
+	cancel_delayed_work_sync(&data->vin_work);
+	debugfs_remove_recursive(data->debugfs);
+	/* Instances probed without wdog_enabled have no watchdog */
+	if (data->wdt_registered)
+		watchdog_unregister_device(&data->wdd);
+	del_timer_sync(&data->wdt_pretimer);
+	unregister_reboot_notifier(&data->reboot_nb);
+	return 0;
+}
+
+/****************************************************************************
+ * POWER MANAGEMENT
+ ****************************************************************************/
+static int __maybe_unused sd109_suspend(struct device *dev)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+
+	if (READ_ONCE(data->vin_sampler))
+		cancel_delayed_work_sync(&data->vin_work);
+
+	/* Replay the whole cached configuration on resume */
+	regcache_mark_dirty(data->regmap);
+
 	return 0;
 }
 
+static int __maybe_unused sd109_resume(struct device *dev)
+{
+	struct sd109_private *data = dev_get_drvdata(dev);
+	int ret;
+
+	/* Watchdog timeout/wait and wakeup alarm are written back in a batch */
+	ret = regcache_sync(data->regmap);
+	if (ret)
+		dev_err(dev, "failed to restore registers on resume\n");
+
+	if (READ_ONCE(data->vin_sampler))
+		schedule_delayed_work(&data->vin_work, 0);
+
+	return ret;
+}
+
+static SIMPLE_DEV_PM_OPS(sd109_pm_ops, sd109_suspend, sd109_resume);
+
 static struct i2c_driver sd109_i2c_driver = {
 	.class		= I2C_CLASS_HWMON,
 	.driver = {
 		.name = "sd109",
+		.pm = &sd109_pm_ops,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe    = sd109_i2c_probe,
 	.remove	  = sd109_remove,
 	.id_table = sd109_id,
 };
-module_i2c_driver(sd109_i2c_driver);
+
+static int __init sd109_init(void)
+{
+	int ret;
+
+	sd109_debugfs_root = debugfs_create_dir("sd109", NULL);
+
+	ret = i2c_add_driver(&sd109_i2c_driver);
+	if (ret)
+		debugfs_remove_recursive(sd109_debugfs_root);
+
+	return ret;
+}
+module_init(sd109_init);
+
+static void __exit sd109_exit(void)
+{
+	i2c_del_driver(&sd109_i2c_driver);
+	debugfs_remove_recursive(sd109_debugfs_root);
+}
+module_exit(sd109_exit);
 
 MODULE_DESCRIPTION("HWMON SD109 driver");
 MODULE_AUTHOR("Massimiliano Negretti <massimiliano.negretti@open-eyes.it>");
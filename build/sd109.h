@@ -31,49 +31,194 @@
 #define _SD109_H
 
 #include <linux/regmap.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 #include <linux/rtc.h>
 #include <linux/time64.h>
+#include <linux/ktime.h>
 #include <linux/watchdog.h>
+#include <linux/kfifo.h>
+#include <linux/miscdevice.h>
+#include <linux/wait.h>
+#include <linux/notifier.h>
+#include <linux/atomic.h>
+#include <linux/timer.h>
+#include <linux/bitmap.h>
+#include <linux/kref.h>
+#include <linux/build_bug.h>
+
+#include "sd109_capture.h"
 
 struct device;
 
 #define NUM_CH_VIN                      5
 
+#define SD109_NUM_REGS                  32
+
+/* Bus format: 8 bit register address, 16 bit values */
+#define SD109_REG_BYTES                 1
+#define SD109_VAL_BYTES                 2
+
+/* Each voltage channel owns an input/min/max register triplet */
+#define SD109_VIN_REGS_PER_CH           3
+#define SD109_VIN_NUM_REGS              (NUM_CH_VIN*SD109_VIN_REGS_PER_CH)
+#define SD109_VIN_INPUT_OFS             0
+#define SD109_VIN_MIN_OFS               1
+#define SD109_VIN_MAX_OFS               2
+
+/* Consecutive block read failures before falling back to single reads */
+#define SD109_VIN_BLOCK_ERRORS          3
+
+/* Snapshot of the whole voltage block, refreshed with a single transfer */
+struct sd109_vin_snapshot {
+  u16                           volt[NUM_CH_VIN];
+  u16                           volt_min[NUM_CH_VIN];
+  u16                           volt_max[NUM_CH_VIN];
+  unsigned long                 alarms;
+  unsigned long                 updated;
+  bool                          valid;
+};
+
+/* Alarm bits of struct sd109_vin_snapshot */
+#define SD109_ALARM_MIN(ch)             (ch)
+#define SD109_ALARM_MAX(ch)             (NUM_CH_VIN + (ch))
+
+/* Capture records carry every voltage channel */
+static_assert(SD109_CAPTURE_CHANNELS == NUM_CH_VIN);
+
+/* Voltage capture state, refcounted: open files may outlive the device */
+struct sd109_capture {
+  struct kref                   ref;
+  /* Cleared on remove, used by the sampler thread only */
+  struct sd109_private          *data;
+  struct miscdevice             misc;
+  struct mutex                  lock;
+  struct task_struct            *thread;
+  DECLARE_KFIFO_PTR(fifo, struct sd109_vin_record);
+  wait_queue_head_t             wait;
+  unsigned long                 channels;
+  unsigned int                  period_us;
+  u64                           samples;
+  u64                           overruns;
+  u64                           errors;
+};
+
+/* Driver operations, for statistics and tracing */
+enum sd109_op {
+  SD109_OP_PROBE,
+  SD109_OP_VIN_INPUT,
+  SD109_OP_VIN_MIN,
+  SD109_OP_VIN_MAX,
+  SD109_OP_VIN_ALARM,
+  SD109_OP_VIN_LIMIT,
+  SD109_OP_VIN_SAMPLE,
+  SD109_OP_CAPTURE,
+  SD109_OP_RTC_READ,
+  SD109_OP_RTC_SET,
+  SD109_OP_ALARM_READ,
+  SD109_OP_ALARM_SET,
+  SD109_OP_WDT_PING,
+  SD109_OP_WDT_START,
+  SD109_OP_WDT_STOP,
+  SD109_OP_WDT_SETTIMEOUT,
+  SD109_OP_REBOOT,
+  SD109_OP_NUM
+};
+
+/* log2 latency histogram buckets: <1us, 1us, 2us, ... 16ms and above */
+#define SD109_HIST_BUCKETS              16
+
+struct sd109_op_stats {
+  atomic64_t                    calls;
+  atomic64_t                    xfers;
+  atomic64_t                    errors;
+  atomic64_t                    cache_hits;
+  atomic64_t                    cache_misses;
+  atomic64_t                    bus_hist[SD109_HIST_BUCKETS];
+  atomic64_t                    lock_hist[SD109_HIST_BUCKETS];
+};
+
+struct sd109_reg_stats {
+  atomic64_t                    reads;
+  atomic64_t                    writes;
+  atomic64_t                    errors;
+  atomic64_t                    cache_hits;
+  atomic64_t                    bus_hist[SD109_HIST_BUCKETS];
+};
+
 struct sd109_private {
   struct i2c_client	            *client;
   struct regmap		              *regmap;
   struct watchdog_device        wdd;
+  struct watchdog_info          wdt_info;
+  struct notifier_block         reboot_nb;
   struct rtc_device	            *rtc;
+  struct device                 *hwmon_dev;
+  struct dentry                 *debugfs;
   bool                          overlay_wdog_nowayout;
   int                           overlay_wdog_timeout;
   int                           overlay_wdog_wait;
   int                           device_wdog_timeout;
   int                           device_wdog_wait;
   int                           wdog_wait;
+  unsigned int                  wdt_hw_timeout;
+  ktime_t                       wdt_last_ping;
+  ktime_t                       wdt_last_keepalive;
+  struct timer_list             wdt_pretimer;
+  u64                           wdt_hw_pings;
+  bool                          wdt_registered;
 	struct mutex                  update_lock;
   u16                           firmware_version;
   bool                          alarm_enabled;
   bool                          alarm_pending;
+  /* RTC counter anchored to boottime */
+  u32                           rtc_resync_interval;
+  bool                          rtc_anchor_valid;
+  time64_t                      rtc_anchor_time;
+  ktime_t                       rtc_anchor_boot;
+  s64                           rtc_drift;
+  s64                           rtc_drift_max;
+  u64                           rtc_resyncs;
 	/* Voltage registers */
-  bool volt_valid[NUM_CH_VIN];
-	u16 volt[NUM_CH_VIN];
-  unsigned long volt_updated[NUM_CH_VIN];
-  /* Voltage max registers */
-  bool volt_max_valid[NUM_CH_VIN];
-	u16 volt_max[NUM_CH_VIN];
-  unsigned long volt_max_updated[NUM_CH_VIN];
-  /* Voltage min registers */
-  bool volt_min_valid[NUM_CH_VIN];
-	u16 volt_min[NUM_CH_VIN];
-  unsigned long volt_min_updated[NUM_CH_VIN];
+  seqlock_t                     vin_lock;
+  struct sd109_vin_snapshot     vin;
+  struct delayed_work           vin_work;
+  bool                          vin_sampler;
+  /* Sampler requested by vin_poll_interval, allowed between probe and remove */
+  bool                          vin_poll;
+  bool                          vin_live;
+  int                           update_interval;
+  /* Voltage thresholds in millivolt */
+  int                           vin_lim_min[NUM_CH_VIN];
+  int                           vin_lim_max[NUM_CH_VIN];
+  int                           vin_hyst[NUM_CH_VIN];
+  /* Voltage capture, NULL if not available */
+  struct sd109_capture          *cap;
+  /* Statistics */
+  struct sd109_op_stats         op_stats[SD109_OP_NUM];
+  struct sd109_reg_stats        reg_stats[SD109_NUM_REGS];
+  /* Regmap lock, owner and transfers of the current driver access */
+  struct mutex                  bus_lock;
+  struct task_struct            *bus_owner;
+  unsigned int                  bus_xfers;
+  DECLARE_BITMAP(bus_fetched, SD109_NUM_REGS);
+  bool                          vin_no_block_read;
+  unsigned int                  vin_block_errors;
+  u64                           vin_xfers;
 };
 
-#define SD109_NUM_REGS                  32
+/*
+ * Register access: RO read-only, WO write-only, RW read/write.
+ * Volatile (never cached) registers are marked with V.
+ */
 
+/* RO */
 #define SD109_CHIP_ID_REG               0x00
 #define SD109_CHIP_ID                   0xd109
+/* RO */
 #define SD109_CHIP_VER_REG              0x01
 
+/* RO, V */
 #define SD109_STATUS                    0x02
 #define SD109_STATUS_POWERUP            0x0001
 #define SD109_STATUS_POWEROFF           0x0002
@@ -83,6 +228,10 @@ struct sd109_private {
 #define SD109_STATUS_BOOT_MASK          0x0007
 #define SD109_STATUS_WDOG_EN            0x0008
 
+/* Chip id, version and status are read together at probe */
+#define SD109_ID_BLOCK_REGS             (SD109_STATUS + 1)
+
+/* WO, V */
 #define SD109_COMMAND                   0x06
 #define SD109_WDOG_ENABLE               0x01
 #define SD109_WDOG_DISABLE              0x02
@@ -90,14 +239,17 @@ struct sd109_private {
 #define SD109_EXEC_REBOOT               0x04
 #define SD109_EXEC_HALT                 0x05
 
+/* WO, V */
 #define SD109_WDOG_REFRESH              0x08
 #define SD109_WDOG_REFRESH_MAGIC_VALUE  0x0d1e
+/* RW */
 #define SD109_WDOG_TIMEOUT              0x09
 #define SD109_WDOG_TIMEOUT_MASK         0x00FF
 #define SD109_WDOG_TIMEOUT_POS          0
 #define SD109_WDOG_WAIT_MASK            0xFF00
 #define SD109_WDOG_WAIT_POS             8
 
+/* RO, V: input/min/max triplet per channel */
 #define SD109_VOLTAGE_5V_BOARD          0x0A
 #define SD109_VOLTAGE_5V_BOARD_MIN      0x0B
 #define SD109_VOLTAGE_5V_BOARD_MAX      0x0C
@@ -105,14 +257,43 @@ struct sd109_private {
 #define SD109_VOLTAGE_3V3_RPI           0x10
 #define SD109_VOLTAGE_1V8_RPI           0x13
 #define SD109_VOLTAGE_12V_BOARD         0x16
+#define SD109_VOLTAGE_LAST              (SD109_VOLTAGE_5V_BOARD + \
+                                        SD109_VIN_NUM_REGS - 1)
 
+/* RW, V */
 #define SD109_RTC0                      0x1A
 #define SD109_RTC1                      0x1B
 #define SD109_RTC2                      0x1C
+/* RW */
 #define SD109_WAKEUP0                   0x1D
 #define SD109_WAKEUP1                   0x1E
 #define SD109_WAKEUP2                   0x1F
 
+/* RTC and wakeup counters are 48 bit wide, split in 16 bit words */
+#define SD109_RTC_WORDS                 3
+#define SD109_RTC_MAX                   0x0000ffffffffffffLL
+#define SD109_RTC_READ_RETRIES          3
+
 #define SD109_MIN_WDOG_WAIT             45
 
+/* Watchdog limits: the MCU counts up to 255s, the core emulates the rest */
+#define SD109_WDOG_MAX_HW_TIMEOUT       255U
+#define SD109_WDOG_MIN_TIMEOUT          5
+#define SD109_WDOG_MIN_HEARTBEAT_MS     2000
+
+/* Voltage snapshot lifetime / sampler period in milliseconds */
+#define SD109_DEF_UPDATE_INTERVAL       1000
+#define SD109_MIN_UPDATE_INTERVAL       100
+#define SD109_MAX_UPDATE_INTERVAL       60000
+
+/* Sampler periods without a successful sample before readers get an error */
+#define SD109_VIN_STALE_INTERVALS       3
+
+/* Default voltage alarm hysteresis in millivolt */
+#define SD109_DEF_VIN_HYST              50
+
+/* Voltage capture ring size in records, retry delay after a bus error in ms */
+#define SD109_DEF_CAPTURE_DEPTH         4096
+#define SD109_CAPTURE_ERROR_DELAY       10
+
 #endif /* _SD109_H */
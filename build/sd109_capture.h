@@ -0,0 +1,47 @@
+/*
+ * sd109_capture.h - Part of OPEN-EYES-II products, Linux kernel modules for
+ * hardware monitoring
+ *
+ * Voltage capture record of sd109-hwmon Linux driver, shared with userspace:
+ * this file must only depend on <linux/types.h>
+ *
+ * This file is part of sd109-hwmon distribution
+ * https://github.com/openeyes-lab/sd109-hwmon
+ *
+ * Copyright (c) 2021 OPEN-EYES Srl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _SD109_CAPTURE_H
+#define _SD109_CAPTURE_H
+
+#include <linux/types.h>
+
+#define SD109_CAPTURE_CHANNELS          5
+
+/*
+ * Voltage capture record, as read from /dev/sd109-capture-<i2c device>.
+ * Voltages are raw register values in millivolt, only the channels set in
+ * the channels bitmask are sampled.
+ */
+struct sd109_vin_record {
+  __u64                         timestamp;    /* ns, CLOCK_BOOTTIME */
+  __u16                         channels;
+  __u16                         volt[SD109_CAPTURE_CHANNELS];
+  __u32                         reserved;
+};
+
+#endif /* _SD109_CAPTURE_H */
@@ -0,0 +1,147 @@
+/*
+ * sd109_trace.h - Part of OPEN-EYES-II products, Linux kernel modules for
+ * hardware monitoring
+ *
+ * Tracepoints of sd109-hwmon Linux driver
+ *
+ * This file is part of sd109-hwmon distribution
+ * https://github.com/openeyes-lab/sd109-hwmon
+ *
+ * Copyright (c) 2021 OPEN-EYES Srl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM sd109
+
+#if !defined(_SD109_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SD109_TRACE_H
+
+#include <linux/device.h>
+#include <linux/ktime.h>
+#include <linux/tracepoint.h>
+
+#include "sd109.h"
+
+/*
+ * Every event is emitted when the call completes and carries its duration,
+ * so latency can be attributed per call without pairing events.
+ */
+
+/* Export the operation values, so perf and trace-cmd can decode op */
+TRACE_DEFINE_ENUM(SD109_OP_VIN_INPUT);
+TRACE_DEFINE_ENUM(SD109_OP_VIN_MIN);
+TRACE_DEFINE_ENUM(SD109_OP_VIN_MAX);
+TRACE_DEFINE_ENUM(SD109_OP_RTC_READ);
+TRACE_DEFINE_ENUM(SD109_OP_RTC_SET);
+TRACE_DEFINE_ENUM(SD109_OP_ALARM_SET);
+
+#define show_sd109_op(op)						\
+	__print_symbolic(op,						\
+		{ SD109_OP_VIN_INPUT,	"vin_input" },			\
+		{ SD109_OP_VIN_MIN,	"vin_min" },			\
+		{ SD109_OP_VIN_MAX,	"vin_max" },			\
+		{ SD109_OP_RTC_READ,	"rtc_read" },			\
+		{ SD109_OP_RTC_SET,	"rtc_set" },			\
+		{ SD109_OP_ALARM_SET,	"alarm_set" })
+
+TRACE_EVENT(sd109_voltage,
+
+	TP_PROTO(struct device *dev, int op, int ch, long val, int ret,
+		 ktime_t delta),
+
+	TP_ARGS(dev, op, ch, val, ret, delta),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(int, op)
+		__field(int, ch)
+		__field(long, val)
+		__field(int, ret)
+		__field(s64, delta_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->op = op;
+		__entry->ch = ch;
+		__entry->val = val;
+		__entry->ret = ret;
+		__entry->delta_ns = ktime_to_ns(delta);
+	),
+
+	TP_printk("%s %s ch=%d val=%ld ret=%d delta_ns=%lld", __get_str(dev),
+		  show_sd109_op(__entry->op), __entry->ch, __entry->val,
+		  __entry->ret, __entry->delta_ns)
+);
+
+TRACE_EVENT(sd109_wdt_ping,
+
+	TP_PROTO(struct device *dev, int ret, ktime_t delta),
+
+	TP_ARGS(dev, ret, delta),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(int, ret)
+		__field(s64, delta_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->ret = ret;
+		__entry->delta_ns = ktime_to_ns(delta);
+	),
+
+	TP_printk("%s ret=%d delta_ns=%lld", __get_str(dev), __entry->ret,
+		  __entry->delta_ns)
+);
+
+TRACE_EVENT(sd109_rtc,
+
+	TP_PROTO(struct device *dev, int op, time64_t time, int ret,
+		 ktime_t delta),
+
+	TP_ARGS(dev, op, time, ret, delta),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(int, op)
+		__field(time64_t, time)
+		__field(int, ret)
+		__field(s64, delta_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev_name(dev));
+		__entry->op = op;
+		__entry->time = time;
+		__entry->ret = ret;
+		__entry->delta_ns = ktime_to_ns(delta);
+	),
+
+	TP_printk("%s %s time=%lld ret=%d delta_ns=%lld", __get_str(dev),
+		  show_sd109_op(__entry->op), __entry->time, __entry->ret,
+		  __entry->delta_ns)
+);
+
+#endif /* _SD109_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE sd109_trace
+#include <trace/define_trace.h>
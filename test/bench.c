@@ -0,0 +1,414 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <linux/rtc.h>
+#include <linux/watchdog.h>
+
+#define DEFAULT_THREADS		4
+#define DEFAULT_DURATION	5
+#define DEFAULT_XFERS		"/sys/module/sd109_emu/parameters/xfers"
+#define NUM_CH_VIN		5
+
+/*
+ * Benchmark of the sd109-hwmon user interfaces. Every phase runs the same
+ * operation from several threads for a fixed time and reports throughput,
+ * p50/p99 latency and, when the sd109-emu module is loaded, the number of
+ * I2C transfers the driver issued per operation.
+ */
+
+enum phase {
+	PHASE_HWMON,
+	PHASE_RTC,
+	PHASE_WDOG,
+};
+
+static const char * const phase_names[] = {
+	[PHASE_HWMON] = "hwmon",
+	[PHASE_RTC] = "rtc",
+	[PHASE_WDOG] = "wdog",
+};
+
+struct worker {
+	pthread_t thread;
+	enum phase phase;
+	int id;
+	int fds[NUM_CH_VIN];
+	unsigned long long *lat;
+	size_t nlat;
+	size_t maxlat;
+	unsigned long long errors;
+};
+
+static char hwmon_dir[300];
+static const char *rtc_dev;
+static const char *wdog_dev;
+static const char *xfers_file = DEFAULT_XFERS;
+static int nthreads = DEFAULT_THREADS;
+static int duration = DEFAULT_DURATION;
+static volatile int stop;
+
+static const char sopts[] = "t:d:H:r:w:x:h";
+static const struct option lopts[] = {
+	{"threads",       required_argument, NULL, 't'},
+	{"duration",      required_argument, NULL, 'd'},
+	{"hwmon",         required_argument, NULL, 'H'},
+	{"rtc",           required_argument, NULL, 'r'},
+	{"watchdog",      required_argument, NULL, 'w'},
+	{"xfers",         required_argument, NULL, 'x'},
+	{"help",                no_argument, NULL, 'h'},
+	{NULL,                  no_argument, NULL, 0x0}
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Looks for the hwmon device registered by the sd109 driver.
+ */
+static int find_hwmon(void)
+{
+	struct dirent *ent;
+	char path[512];
+	char name[32];
+	DIR *dir;
+	FILE *f;
+	int found = 0;
+
+	dir = opendir("/sys/class/hwmon");
+	if (!dir)
+		return -1;
+
+	while (!found && (ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/hwmon/%s/name", ent->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fgets(name, sizeof(name), f) && !strncmp(name, "sd109", 5)) {
+			snprintf(hwmon_dir, sizeof(hwmon_dir), "/sys/class/hwmon/%s",
+				 ent->d_name);
+			found = 1;
+		}
+		fclose(f);
+	}
+	closedir(dir);
+
+	return found ? 0 : -1;
+}
+
+/*
+ * Reads the transfer counter of the emulator, returns -1 when missing.
+ */
+static long long read_xfers(void)
+{
+	unsigned long long count;
+	FILE *f = fopen(xfers_file, "r");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = fscanf(f, "%llu", &count);
+	fclose(f);
+
+	return (ret == 1) ? (long long)count : -1;
+}
+
+static int record(struct worker *w, unsigned long long lat)
+{
+	unsigned long long *tmp;
+
+	if (w->nlat == w->maxlat) {
+		w->maxlat = w->maxlat ? w->maxlat*2 : 4096;
+		tmp = realloc(w->lat, w->maxlat*sizeof(*w->lat));
+		if (!tmp)
+			return -1;
+		w->lat = tmp;
+	}
+	w->lat[w->nlat++] = lat;
+
+	return 0;
+}
+
+static int op_hwmon(struct worker *w, unsigned long n)
+{
+	char buf[32];
+
+	return pread(w->fds[n % NUM_CH_VIN], buf, sizeof(buf), 0) > 0 ? 0 : -1;
+}
+
+static int op_rtc(struct worker *w, unsigned long n)
+{
+	struct rtc_time tm;
+
+	return ioctl(w->fds[0], RTC_RD_TIME, &tm);
+}
+
+static int op_wdog(struct worker *w, unsigned long n)
+{
+	int dummy;
+
+	return ioctl(w->fds[0], WDIOC_KEEPALIVE, &dummy);
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	int (*op)(struct worker *, unsigned long);
+	unsigned long long start;
+	unsigned long n;
+
+	switch (w->phase) {
+	case PHASE_HWMON:
+		op = op_hwmon;
+		break;
+	case PHASE_RTC:
+		op = op_rtc;
+		break;
+	default:
+		op = op_wdog;
+		break;
+	}
+
+	/* Threads start on different channels */
+	for (n = w->id; !stop; n++) {
+		start = now_ns();
+		if (op(w, n)) {
+			w->errors++;
+			continue;
+		}
+		if (record(w, now_ns() - start))
+			break;
+	}
+
+	return NULL;
+}
+
+static int worker_open(struct worker *w)
+{
+	char path[512];
+	int ch;
+
+	switch (w->phase) {
+	case PHASE_HWMON:
+		for (ch = 0; ch < NUM_CH_VIN; ch++) {
+			snprintf(path, sizeof(path), "%s/in%d_input", hwmon_dir, ch);
+			w->fds[ch] = open(path, O_RDONLY);
+			if (w->fds[ch] < 0) {
+				printf("Unable to open %s: %s\n", path, strerror(errno));
+				return -1;
+			}
+		}
+		return 0;
+	case PHASE_RTC:
+		w->fds[0] = open(rtc_dev, O_RDONLY);
+		break;
+	default:
+		w->fds[0] = open(wdog_dev, O_WRONLY);
+		break;
+	}
+
+	if (w->fds[0] < 0) {
+		printf("Unable to open %s: %s\n",
+		       w->phase == PHASE_RTC ? rtc_dev : wdog_dev, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void worker_close(struct worker *w)
+{
+	const char v = 'V';
+	int ch;
+
+	/* Magic close, so the watchdog is stopped on exit */
+	if (w->phase == PHASE_WDOG && w->fds[0] >= 0 && write(w->fds[0], &v, 1) < 0)
+		printf("Watchdog magic close failed: %s\n", strerror(errno));
+
+	for (ch = 0; ch < NUM_CH_VIN; ch++) {
+		if (w->fds[ch] >= 0)
+			close(w->fds[ch]);
+	}
+	free(w->lat);
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(enum phase phase, int threads, struct worker *workers,
+		   double elapsed, long long xfers)
+{
+	unsigned long long *all;
+	unsigned long long errors = 0;
+	size_t total = 0;
+	size_t i;
+	int t;
+
+	for (t = 0; t < threads; t++) {
+		total += workers[t].nlat;
+		errors += workers[t].errors;
+	}
+
+	printf("%-6s threads %2d ops %8zu errors %llu", phase_names[phase],
+	       threads, total, errors);
+	if (!total) {
+		printf("\n");
+		return;
+	}
+
+	all = malloc(total*sizeof(*all));
+	if (!all) {
+		printf("\n");
+		return;
+	}
+	for (t = 0, i = 0; t < threads; t++) {
+		memcpy(&all[i], workers[t].lat, workers[t].nlat*sizeof(*all));
+		i += workers[t].nlat;
+	}
+	qsort(all, total, sizeof(*all), cmp_ull);
+
+	printf(" %10.1f ops/s p50 %8.1f us p99 %8.1f us", total/elapsed,
+	       all[total*50/100]/1000.0, all[total*99/100]/1000.0);
+	if (xfers >= 0)
+		printf(" xfers/op %.3f", (double)xfers/total);
+	printf("\n");
+
+	free(all);
+}
+
+static int run_phase(enum phase phase, int threads)
+{
+	struct worker *workers;
+	long long xfers_start, xfers_end;
+	unsigned long long start;
+	int ret = 0;
+	int t, ch;
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		return -1;
+
+	for (t = 0; t < threads; t++) {
+		workers[t].phase = phase;
+		workers[t].id = t;
+		for (ch = 0; ch < NUM_CH_VIN; ch++)
+			workers[t].fds[ch] = -1;
+	}
+	for (t = 0; t < threads; t++) {
+		ret = worker_open(&workers[t]);
+		if (ret)
+			goto out;
+	}
+
+	stop = 0;
+	xfers_start = read_xfers();
+	start = now_ns();
+	for (t = 0; t < threads; t++)
+		pthread_create(&workers[t].thread, NULL, worker_run, &workers[t]);
+
+	sleep(duration);
+	stop = 1;
+
+	for (t = 0; t < threads; t++)
+		pthread_join(workers[t].thread, NULL);
+	xfers_end = read_xfers();
+
+	report(phase, threads, workers, (now_ns() - start)/1e9,
+	       (xfers_start >= 0 && xfers_end >= 0) ? xfers_end - xfers_start : -1);
+
+out:
+	for (t = 0; t < threads; t++)
+		worker_close(&workers[t]);
+	free(workers);
+
+	return ret;
+}
+
+static void usage(char *progname)
+{
+	printf("Usage: %s [options]\n", progname);
+	printf(" -t, --threads=T     Concurrent readers (default %d)\n",
+	       DEFAULT_THREADS);
+	printf(" -d, --duration=D    Seconds per phase (default %d)\n",
+	       DEFAULT_DURATION);
+	printf(" -H, --hwmon=DIR     sd109 hwmon directory (default: look up)\n");
+	printf(" -r, --rtc=DEV       Benchmark RTC_RD_TIME on DEV\n");
+	printf(" -w, --watchdog=DEV  Benchmark WDIOC_KEEPALIVE on DEV\n");
+	printf(" -x, --xfers=FILE    I2C transfer counter (default %s)\n",
+	       DEFAULT_XFERS);
+	printf("The watchdog is started by the benchmark and stopped with the\n");
+	printf("magic close on exit, it is a single-open device so one thread\n");
+	printf("is used.\n");
+	printf("Example: %s -t 8 -r /dev/rtc1 -w /dev/watchdog1\n", progname);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			if (nthreads < 1)
+				nthreads = 1;
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			if (duration < 1)
+				duration = 1;
+			break;
+		case 'H':
+			snprintf(hwmon_dir, sizeof(hwmon_dir), "%s", optarg);
+			break;
+		case 'r':
+			rtc_dev = optarg;
+			break;
+		case 'w':
+			wdog_dev = optarg;
+			break;
+		case 'x':
+			xfers_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	if (!hwmon_dir[0] && find_hwmon())
+		printf("sd109 hwmon device not found, hwmon phase skipped\n");
+
+	if (read_xfers() < 0)
+		printf("Unable to read %s, xfers/op not reported\n", xfers_file);
+
+	if (hwmon_dir[0])
+		ret |= run_phase(PHASE_HWMON, nthreads);
+	if (rtc_dev)
+		ret |= run_phase(PHASE_RTC, nthreads);
+	if (wdog_dev)
+		ret |= run_phase(PHASE_WDOG, 1);
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,461 @@
+/*
+ * sd109-emu.c - Part of OPEN-EYES-II products, Linux kernel modules for
+ * hardware monitoring
+ * This module emulates the SD109 FW running on ATTINY817, so that the
+ * sd109-hwmon driver can be tested and benchmarked without the hardware.
+ *
+ * It registers a virtual I2C adapter answering at address 0x35 with the
+ * register map of build/sd109.h, and instantiates the sd109 client on it:
+ * 1) chip id, version and status
+ * 2) voltage input/min/max triplets, with some noise
+ * 3) 48 bit RTC counter and wakeup registers
+ * 4) watchdog timeout/wait encoding, enable/disable and refresh
+ *
+ * Every I2C transfer is counted and can be delayed to emulate a slow bus.
+ * Bus errors and firmware without block read support can be emulated to
+ * exercise the driver error paths.
+ *
+ * This file is part of sd109-hwmon distribution
+ * https://github.com/openeyes-lab/sd109-hwmon
+ *
+ * Copyright (c) 2021 OPEN-EYES Srl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <linux/module.h>
+#include <linux/i2c.h>
+#include <linux/property.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/delay.h>
+#include <linux/random.h>
+#include <linux/timekeeping.h>
+
+#include "sd109.h"
+
+#define SD109_EMU_ADDR                  0x35
+#define SD109_EMU_NOISE                 20
+
+static unsigned int latency_us = 200;
+module_param(latency_us, uint, 0644);
+MODULE_PARM_DESC(latency_us, "Delay added to every I2C transfer, in us");
+
+static unsigned long xfers;
+module_param(xfers, ulong, 0644);
+MODULE_PARM_DESC(xfers, "I2C transfers served, write 0 to reset");
+
+static uint error_rate;
+module_param(error_rate, uint, 0644);
+MODULE_PARM_DESC(error_rate, "Transfers failing with -EIO, per thousand");
+
+static unsigned long errors;
+module_param(errors, ulong, 0644);
+MODULE_PARM_DESC(errors, "Injected transfer errors, write 0 to reset");
+
+static bool reject_block;
+module_param(reject_block, bool, 0644);
+MODULE_PARM_DESC(reject_block, "Fail multi-register reads with -EIO");
+
+static bool no_autoinc;
+module_param(no_autoinc, bool, 0644);
+MODULE_PARM_DESC(no_autoinc, "No register auto-increment: multi-register "
+		"reads repeat the first register, writes all land on it");
+
+static ushort status = SD109_STATUS_POWERUP;
+module_param(status, ushort, 0444);
+MODULE_PARM_DESC(status, "Boot status reported at probe: 1 powerup, "
+		"2 poweroff, 3 reboot, 4 halt, 5 wakeup");
+
+static unsigned long wdog_expired;
+module_param(wdog_expired, ulong, 0444);
+MODULE_PARM_DESC(wdog_expired, "Emulated watchdog expirations");
+
+static ushort firmware_version = 0x0100;
+module_param(firmware_version, ushort, 0444);
+MODULE_PARM_DESC(firmware_version, "Reported firmware version");
+
+static bool wdog_enabled = true;
+module_param(wdog_enabled, bool, 0444);
+MODULE_PARM_DESC(wdog_enabled, "Pass wdog_enabled to the driver");
+
+static bool rtc_enabled = true;
+module_param(rtc_enabled, bool, 0444);
+MODULE_PARM_DESC(rtc_enabled, "Pass rtc_enabled to the driver");
+
+static uint vin_poll_interval;
+module_param(vin_poll_interval, uint, 0444);
+MODULE_PARM_DESC(vin_poll_interval, "Driver voltage sampler period in ms, 0 off");
+
+static uint rtc_resync_interval;
+module_param(rtc_resync_interval, uint, 0444);
+MODULE_PARM_DESC(rtc_resync_interval, "Driver RTC resync interval in s, 0 off");
+
+/* Nominal voltage of every channel in millivolt */
+static const u16 sd109_emu_nominal[NUM_CH_VIN] = { 5000, 5050, 3300, 1800, 12000 };
+
+struct sd109_emu {
+  struct i2c_adapter            adap;
+  struct i2c_client             *client;
+  /* Taken in softirq context by the watchdog timer */
+  spinlock_t                    lock;
+  u16                           regs[SD109_NUM_REGS];
+  u8                            pointer;
+  /* RTC counter is boottime seconds plus offset */
+  time64_t                      rtc_offset;
+  struct timer_list             wdog_timer;
+};
+
+static struct sd109_emu *sd109_emu;
+
+/****************************************************************************
+ * REGISTER MAP
+ ****************************************************************************/
+static time64_t sd109_emu_rtc(struct sd109_emu *emu)
+{
+	return ktime_get_boottime_seconds() + emu->rtc_offset;
+}
+
+static void sd109_emu_wdog_kick(struct sd109_emu *emu)
+{
+	unsigned int timeout = emu->regs[SD109_WDOG_TIMEOUT] &
+							SD109_WDOG_TIMEOUT_MASK;
+
+	mod_timer(&emu->wdog_timer, jiffies + timeout*HZ);
+}
+
+/*
+ * On expiry the firmware reboots the host, then waits wdog_wait seconds for
+ * it to boot and refresh the watchdog again before the next reboot.
+ */
+static void sd109_emu_wdog_expire(struct timer_list *t)
+{
+	struct sd109_emu *emu = from_timer(emu, t, wdog_timer);
+	unsigned int wait;
+
+	spin_lock(&emu->lock);
+	/* Disabled while the timer was firing */
+	if (!(emu->regs[SD109_STATUS] & SD109_STATUS_WDOG_EN)) {
+		spin_unlock(&emu->lock);
+		return;
+	}
+	wait = ((emu->regs[SD109_WDOG_TIMEOUT] & SD109_WDOG_WAIT_MASK)>>
+					SD109_WDOG_WAIT_POS)*5;
+	wait = max_t(unsigned int, wait, SD109_MIN_WDOG_WAIT);
+	wdog_expired++;
+	emu->regs[SD109_STATUS] = SD109_STATUS_REBOOT | SD109_STATUS_WDOG_EN;
+	mod_timer(&emu->wdog_timer, jiffies + wait*HZ);
+	spin_unlock(&emu->lock);
+
+	dev_warn(&emu->adap.dev,
+				"emulated watchdog expired, would reboot, next in %u s\n", wait);
+}
+
+static void sd109_emu_command(struct sd109_emu *emu, u16 cmd)
+{
+	switch (cmd) {
+		case SD109_WDOG_ENABLE:
+			emu->regs[SD109_STATUS] |= SD109_STATUS_WDOG_EN;
+			sd109_emu_wdog_kick(emu);
+			break;
+		case SD109_WDOG_DISABLE:
+			emu->regs[SD109_STATUS] &= ~SD109_STATUS_WDOG_EN;
+			del_timer(&emu->wdog_timer);
+			break;
+		case SD109_EXEC_POWEROFF:
+			dev_info(&emu->adap.dev, "POWEROFF command\n");
+			break;
+		case SD109_EXEC_REBOOT:
+			dev_info(&emu->adap.dev, "REBOOT command\n");
+			break;
+		case SD109_EXEC_HALT:
+			dev_info(&emu->adap.dev, "HALT command\n");
+			break;
+		default:
+			dev_warn(&emu->adap.dev, "unknown command %x\n", cmd);
+			break;
+	}
+}
+
+static u16 sd109_emu_read_reg(struct sd109_emu *emu, u8 reg)
+{
+	int ofs, ch;
+	u16 volt;
+
+	switch (reg) {
+		case SD109_CHIP_ID_REG:
+		case SD109_CHIP_VER_REG:
+		case SD109_STATUS:
+		case SD109_WDOG_TIMEOUT:
+		case SD109_WAKEUP0:
+		case SD109_WAKEUP1:
+		case SD109_WAKEUP2:
+			return emu->regs[reg];
+		case SD109_RTC0:
+			return sd109_emu_rtc(emu) & 0xffff;
+		case SD109_RTC1:
+			return (sd109_emu_rtc(emu)>>16) & 0xffff;
+		case SD109_RTC2:
+			return (sd109_emu_rtc(emu)>>32) & 0xffff;
+		default:
+			break;
+	}
+
+	if ((reg < SD109_VOLTAGE_5V_BOARD) || (reg > SD109_VOLTAGE_LAST))
+		return 0xffff;
+
+	ch = (reg - SD109_VOLTAGE_5V_BOARD)/SD109_VIN_REGS_PER_CH;
+	ofs = (reg - SD109_VOLTAGE_5V_BOARD)%SD109_VIN_REGS_PER_CH;
+	reg = SD109_VOLTAGE_5V_BOARD + ch*SD109_VIN_REGS_PER_CH;
+
+	if (ofs != SD109_VIN_INPUT_OFS)
+		return emu->regs[reg + ofs];
+
+	/* New input sample, min and max track it like the firmware does */
+	volt = sd109_emu_nominal[ch] - SD109_EMU_NOISE +
+					get_random_u32()%(2*SD109_EMU_NOISE + 1);
+	emu->regs[reg + SD109_VIN_INPUT_OFS] = volt;
+	if (volt < emu->regs[reg + SD109_VIN_MIN_OFS])
+		emu->regs[reg + SD109_VIN_MIN_OFS] = volt;
+	if (volt > emu->regs[reg + SD109_VIN_MAX_OFS])
+		emu->regs[reg + SD109_VIN_MAX_OFS] = volt;
+
+	return volt;
+}
+
+static void sd109_emu_write_reg(struct sd109_emu *emu, u8 reg, u16 val)
+{
+	time64_t rtc;
+	int shift;
+
+	switch (reg) {
+		case SD109_COMMAND:
+			sd109_emu_command(emu, val);
+			break;
+		case SD109_WDOG_REFRESH:
+			if ((val == SD109_WDOG_REFRESH_MAGIC_VALUE) &&
+						(emu->regs[SD109_STATUS] & SD109_STATUS_WDOG_EN))
+				sd109_emu_wdog_kick(emu);
+			break;
+		case SD109_WDOG_TIMEOUT:
+		case SD109_WAKEUP0:
+		case SD109_WAKEUP1:
+		case SD109_WAKEUP2:
+			emu->regs[reg] = val;
+			break;
+		case SD109_RTC0:
+		case SD109_RTC1:
+		case SD109_RTC2:
+			/* Replace one word of the running counter */
+			shift = (reg - SD109_RTC0)*16;
+			rtc = sd109_emu_rtc(emu);
+			rtc &= ~((time64_t)0xffff << shift);
+			rtc |= (time64_t)val << shift;
+			emu->rtc_offset = rtc - ktime_get_boottime_seconds();
+			break;
+		default:
+			/* Read-only and unknown registers ignore writes */
+			break;
+	}
+}
+
+/****************************************************************************
+ * I2C ADAPTER
+ ****************************************************************************/
+
+/*
+ * Messages follow the regmap layout used by the driver: a write message
+ * starts with the register pointer followed by big endian 16 bit values, a
+ * read message returns values from the pointer. The pointer auto-increments
+ * after every value, read or written, unless no_autoinc is set.
+ */
+static int sd109_emu_xfer(struct i2c_adapter *adap, struct i2c_msg *msgs,
+			int num)
+{
+	struct sd109_emu *emu = i2c_get_adapdata(adap);
+	struct i2c_msg *msg;
+	u16 val;
+	int i, j;
+
+	for (i=0; i<num; i++) {
+		if (msgs[i].addr != SD109_EMU_ADDR)
+			return -ENXIO;
+	}
+
+	xfers++;
+	if (latency_us)
+		usleep_range(latency_us, latency_us + latency_us/8 + 1);
+
+	if (error_rate && (get_random_u32()%1000 < error_rate)) {
+		errors++;
+		return -EIO;
+	}
+
+	for (i=0; i<num; i++) {
+		if ((msgs[i].flags & I2C_M_RD) && (msgs[i].len > 2) && reject_block) {
+			errors++;
+			return -EIO;
+		}
+	}
+
+	spin_lock_bh(&emu->lock);
+	for (i=0; i<num; i++) {
+		msg = &msgs[i];
+
+		if (msg->flags & I2C_M_RD) {
+			for (j=0; j+1<msg->len; j+=2) {
+				val = sd109_emu_read_reg(emu, emu->pointer % SD109_NUM_REGS);
+				if (!no_autoinc)
+					emu->pointer++;
+				msg->buf[j] = val>>8;
+				msg->buf[j+1] = val & 0xff;
+			}
+			continue;
+		}
+
+		if (!msg->len)
+			continue;
+
+		emu->pointer = msg->buf[0];
+		for (j=1; j+1<msg->len; j+=2) {
+			val = (msg->buf[j]<<8) | msg->buf[j+1];
+			sd109_emu_write_reg(emu, emu->pointer % SD109_NUM_REGS, val);
+			if (!no_autoinc)
+				emu->pointer++;
+		}
+	}
+	spin_unlock_bh(&emu->lock);
+
+	return num;
+}
+
+static u32 sd109_emu_func(struct i2c_adapter *adap)
+{
+	return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+
+static const struct i2c_algorithm sd109_emu_algo = {
+	.master_xfer = sd109_emu_xfer,
+	.functionality = sd109_emu_func,
+};
+
+/****************************************************************************
+ * MODULE INIT / EXIT
+ ****************************************************************************/
+static struct property_entry sd109_emu_props[8];
+
+static const struct software_node sd109_emu_node = {
+	.properties = sd109_emu_props,
+};
+
+static int __init sd109_emu_init(void)
+{
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO("sd109", SD109_EMU_ADDR),
+		.swnode = &sd109_emu_node,
+	};
+	struct sd109_emu *emu;
+	int nprops = 0;
+	int ch, ret;
+
+	if (!status || (status > SD109_STATUS_WAKEUP))
+		return -EINVAL;
+
+	emu = kzalloc(sizeof(*emu), GFP_KERNEL);
+	if (!emu)
+		return -ENOMEM;
+
+	spin_lock_init(&emu->lock);
+	timer_setup(&emu->wdog_timer, sd109_emu_wdog_expire, 0);
+
+	emu->regs[SD109_CHIP_ID_REG] = SD109_CHIP_ID;
+	emu->regs[SD109_CHIP_VER_REG] = firmware_version;
+	emu->regs[SD109_STATUS] = status;
+	emu->regs[SD109_WDOG_TIMEOUT] = (60<<SD109_WDOG_TIMEOUT_POS) |
+						((SD109_MIN_WDOG_WAIT/5)<<SD109_WDOG_WAIT_POS);
+	for (ch=0; ch<NUM_CH_VIN; ch++) {
+		emu->regs[SD109_VOLTAGE_5V_BOARD + ch*SD109_VIN_REGS_PER_CH +
+					SD109_VIN_INPUT_OFS] = sd109_emu_nominal[ch];
+		emu->regs[SD109_VOLTAGE_5V_BOARD + ch*SD109_VIN_REGS_PER_CH +
+					SD109_VIN_MIN_OFS] = sd109_emu_nominal[ch];
+		emu->regs[SD109_VOLTAGE_5V_BOARD + ch*SD109_VIN_REGS_PER_CH +
+					SD109_VIN_MAX_OFS] = sd109_emu_nominal[ch];
+	}
+	emu->rtc_offset = ktime_get_real_seconds() - ktime_get_boottime_seconds();
+
+	/* Same properties the overlay gives to the real device */
+	if (wdog_enabled)
+		sd109_emu_props[nprops++] = PROPERTY_ENTRY_BOOL("wdog_enabled");
+	if (rtc_enabled)
+		sd109_emu_props[nprops++] = PROPERTY_ENTRY_BOOL("rtc_enabled");
+	if (vin_poll_interval)
+		sd109_emu_props[nprops++] = PROPERTY_ENTRY_U32("vin_poll_interval",
+						vin_poll_interval);
+	if (rtc_resync_interval)
+		sd109_emu_props[nprops++] = PROPERTY_ENTRY_U32("rtc_resync_interval",
+						rtc_resync_interval);
+	if (no_autoinc)
+		sd109_emu_props[nprops++] = PROPERTY_ENTRY_BOOL("vin_no_block_read");
+
+	emu->adap.owner = THIS_MODULE;
+	emu->adap.class = I2C_CLASS_HWMON;
+	emu->adap.algo = &sd109_emu_algo;
+	strscpy(emu->adap.name, "sd109-emu", sizeof(emu->adap.name));
+	i2c_set_adapdata(&emu->adap, emu);
+
+	ret = i2c_add_adapter(&emu->adap);
+	if (ret)
+		goto free;
+
+	emu->client = i2c_new_client_device(&emu->adap, &info);
+	if (IS_ERR(emu->client)) {
+		ret = PTR_ERR(emu->client);
+		goto del;
+	}
+
+	sd109_emu = emu;
+	dev_info(&emu->adap.dev,
+				"SD109 emulated on %s, %u us per transfer, status %u\n",
+				dev_name(&emu->client->dev), latency_us, status);
+
+	return 0;
+
+del:
+	i2c_del_adapter(&emu->adap);
+free:
+	kfree(emu);
+	return ret;
+}
+module_init(sd109_emu_init);
+
+static void __exit sd109_emu_exit(void)
+{
+	struct sd109_emu *emu = sd109_emu;
+
+	i2c_unregister_device(emu->client);
+	i2c_del_adapter(&emu->adap);
+
+	/* The expiry handler re-arms the timer only while enabled */
+	spin_lock_bh(&emu->lock);
+	emu->regs[SD109_STATUS] &= ~SD109_STATUS_WDOG_EN;
+	spin_unlock_bh(&emu->lock);
+	del_timer_sync(&emu->wdog_timer);
+	kfree(emu);
+}
+module_exit(sd109_emu_exit);
+
+MODULE_DESCRIPTION("SD109 firmware emulator for sd109-hwmon testing");
+MODULE_AUTHOR("Massimiliano Negretti <massimiliano.negretti@open-eyes.it>");
+MODULE_LICENSE("GPL");
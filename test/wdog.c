@@ -6,15 +6,21 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <getopt.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
 #include <linux/watchdog.h>
 
 #define DEFAULT_PING_RATE	1
+#define STATS_PERIOD		10
 
 int fd;
 const char v = 'V';
-static const char sopts[] = "bdehp:t:Tn:NLf:i";
+static const char *stats_file;
+static unsigned long long pings_requested;
+static unsigned long long hw_pings_start;
+static struct timespec stats_start;
+static const char sopts[] = "bdehp:t:Tn:NLf:is:";
 static const struct option lopts[] = {
 	{"bootstatus",          no_argument, NULL, 'b'},
 	{"disable",             no_argument, NULL, 'd'},
@@ -28,6 +34,7 @@ static const struct option lopts[] = {
 	{"gettimeleft",		no_argument, NULL, 'L'},
 	{"file",          required_argument, NULL, 'f'},
 	{"info",		no_argument, NULL, 'i'},
+	{"stats",         required_argument, NULL, 's'},
 	{NULL,                  no_argument, NULL, 0x0}
 };
 
@@ -42,8 +49,63 @@ static void keep_alive(void)
 	int ret;
 
 	ret = ioctl(fd, WDIOC_KEEPALIVE, &dummy);
-	if (!ret)
+	if (!ret) {
 		printf(".");
+		pings_requested++;
+	}
+}
+
+/*
+ * Reads the number of keepalives the driver actually sent to the MCU,
+ * exported in debugfs as wdt_hw_pings.
+ */
+static int read_hw_pings(unsigned long long *count)
+{
+	FILE *f = fopen(stats_file, "r");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = (fscanf(f, "%llu", count) == 1) ? 0 : -1;
+	fclose(f);
+	return ret;
+}
+
+static void stats_begin(void)
+{
+	if (!stats_file)
+		return;
+
+	if (read_hw_pings(&hw_pings_start)) {
+		printf("Unable to read %s, stats disabled\n", stats_file);
+		stats_file = NULL;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stats_start);
+}
+
+/*
+ * Prints the keepalives requested by this program against the ones the
+ * watchdog core and the driver actually sent to the MCU.
+ */
+static void stats_report(void)
+{
+	unsigned long long hw_pings;
+	struct timespec now;
+	double elapsed;
+
+	if (!stats_file || read_hw_pings(&hw_pings))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - stats_start.tv_sec) +
+		(now.tv_nsec - stats_start.tv_nsec) / 1e9;
+	if (elapsed <= 0)
+		return;
+
+	printf("\nPings requested %llu (%.2f/s), sent to MCU %llu (%.2f/s)\n",
+	       pings_requested, pings_requested / elapsed,
+	       hw_pings - hw_pings_start, (hw_pings - hw_pings_start) / elapsed);
 }
 
 /*
@@ -53,7 +115,10 @@ static void keep_alive(void)
 
 static void term(int sig)
 {
-	int ret = write(fd, &v, 1);
+	int ret;
+
+	stats_report();
+	ret = write(fd, &v, 1);
 
 	close(fd);
 	if (ret < 0)
@@ -80,6 +145,8 @@ static void usage(char *progname)
 	printf(" -n, --pretimeout=T\tSet the pretimeout to T seconds\n");
 	printf(" -N, --getpretimeout\tGet the pretimeout\n");
 	printf(" -L, --gettimeleft\tGet the time left until timer expires\n");
+	printf(" -s, --stats=F\t\tReport pings sent to the MCU, read from\n");
+	printf("\t\t\tdebugfs file F (.../sd109/<dev>/wdt_hw_pings)\n");
 	printf("\n");
 	printf("Parameters are parsed left-to-right in real-time.\n");
 	printf("Example: %s -d -t 10 -p 5 -e\n", progname);
@@ -101,6 +168,8 @@ int main(int argc, char *argv[])
 	while ((c = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
 		if (c == 'f')
 			file = optarg;
+		else if (c == 's')
+			stats_file = optarg;
 	}
 
 	fd = open(file, O_WRONLY);
@@ -211,6 +280,7 @@ int main(int argc, char *argv[])
 				printf("WDIOC_GETTIMELEFT error '%s'\n", strerror(errno));
 			break;
 		case 'f':
+		case 's':
 			/* Handled above */
 			break;
 		case 'i':
@@ -239,8 +309,12 @@ int main(int argc, char *argv[])
 
 	signal(SIGINT, term);
 
+	stats_begin();
+
 	while (1) {
 		keep_alive();
+		if (!(pings_requested % STATS_PERIOD))
+			stats_report();
 		sleep(ping_rate);
 	}
 end: